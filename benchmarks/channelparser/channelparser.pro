@@ -0,0 +1,16 @@
+QT += core
+QT -= gui
+
+TARGET = channelparser-bench
+TEMPLATE = app
+
+CONFIG += c++14 console
+CONFIG -= app_bundle
+
+INCLUDEPATH += ../..
+
+SOURCES += main.cpp \
+    ../../channelparser.cpp
+
+HEADERS += ../../channelparser.h \
+    ../../cpufeatures.h
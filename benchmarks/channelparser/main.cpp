@@ -0,0 +1,142 @@
+//  gamma-viewer-3d - 3d visualization of sessions generated by gamma-analyzer
+//  Copyright (C) 2017  Dag Robole
+//
+//  This program is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+// Compares the channel parser against the QString::split based parsing it
+// replaced, on rows shaped like the spectrum.channels column.
+
+#include "channelparser.h"
+#include <cstdio>
+#include <random>
+#include <vector>
+#include <QString>
+#include <QStringList>
+#include <QByteArray>
+#include <QElapsedTimer>
+
+static std::vector<QString> makeRows(int numRows, int numChannels)
+{
+    std::mt19937 rng(1234);
+    std::vector<QString> rows;
+
+    for(int r = 0; r < numRows; r++)
+    {
+        QString row;
+        for(int c = 0; c < numChannels; c++)
+        {
+            // Mostly small counts with the occasional peak
+            int count = (rng() % 16 == 0) ? (int)(rng() % 20000) : (int)(rng() % 40);
+            row += QString::number(count);
+            row += ' ';
+        }
+        rows.push_back(row);
+    }
+
+    return rows;
+}
+
+static long long parseSplit(const std::vector<QString> &rows, std::vector<int> &channels)
+{
+    long long checksum = 0;
+
+    for(const auto &row : rows)
+    {
+        channels.clear();
+
+        auto strChanList = row.split(' ', QString::SplitBehavior::SkipEmptyParts);
+        for(const auto &chan : strChanList)
+            channels.emplace_back(chan.toInt());
+
+        for(auto c : channels)
+            checksum += c;
+    }
+
+    return checksum;
+}
+
+static long long parseUtf16(const std::vector<QString> &rows, std::vector<int> &channels)
+{
+    long long checksum = 0;
+
+    for(const auto &row : rows)
+    {
+        channels.clear();
+        Gamma::parseChannels(row.utf16(), (std::size_t)row.size(), channels);
+
+        for(auto c : channels)
+            checksum += c;
+    }
+
+    return checksum;
+}
+
+static long long parseUtf8(const std::vector<QByteArray> &rows, std::vector<int> &channels)
+{
+    long long checksum = 0;
+
+    for(const auto &row : rows)
+    {
+        channels.clear();
+        Gamma::parseChannels(row.constData(), (std::size_t)row.size(), channels);
+
+        for(auto c : channels)
+            checksum += c;
+    }
+
+    return checksum;
+}
+
+template<typename F>
+static void report(const char *name, int numRows, int iterations, F parse)
+{
+    QElapsedTimer timer;
+    long long checksum = 0;
+
+    timer.start();
+    for(int i = 0; i < iterations; i++)
+        checksum += parse();
+    qint64 ns = timer.nsecsElapsed();
+
+    std::printf("%-24s %10.1f ns/row  (checksum %lld)\n",
+                name, (double)ns / ((double)numRows * iterations), checksum);
+}
+
+int main()
+{
+    const int numRows = 2000;
+    const int numChannels = 1024;
+    const int iterations = 10;
+
+    auto rows = makeRows(numRows, numChannels);
+
+    std::vector<QByteArray> rowsUtf8;
+    for(const auto &row : rows)
+        rowsUtf8.push_back(row.toUtf8());
+
+    std::vector<int> channels;
+    channels.reserve(numChannels);
+
+    std::printf("%d rows of %d channels, %d iterations\n",
+                numRows, numChannels, iterations);
+
+    report("QString::split/toInt", numRows, iterations,
+           [&]() { return parseSplit(rows, channels); });
+    report("parseChannels UTF-16", numRows, iterations,
+           [&]() { return parseUtf16(rows, channels); });
+    report("parseChannels UTF-8", numRows, iterations,
+           [&]() { return parseUtf8(rowsUtf8, channels); });
+
+    return 0;
+}
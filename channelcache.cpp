@@ -0,0 +1,66 @@
+//  gamma-viewer-3d - 3d visualization of sessions generated by gamma-analyzer
+//  Copyright (C) 2017  Dag Robole
+//
+//  This program is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "channelcache.h"
+
+namespace Gamma
+{
+
+ChannelCache::ChannelCache(std::size_t capacity)
+    :
+      mCapacity(capacity ? capacity : 1)
+{
+}
+
+const std::vector<int> *ChannelCache::find(int sessionIndex)
+{
+    auto it = mIndex.find(sessionIndex);
+    if(it == mIndex.end())
+        return nullptr;
+
+    mEntries.splice(mEntries.begin(), mEntries, it->second);
+    return &it->second->second;
+}
+
+const std::vector<int> &ChannelCache::insert(int sessionIndex, std::vector<int> &&channels)
+{
+    auto it = mIndex.find(sessionIndex);
+    if(it != mIndex.end())
+    {
+        it->second->second = std::move(channels);
+        mEntries.splice(mEntries.begin(), mEntries, it->second);
+        return mEntries.front().second;
+    }
+
+    if(mEntries.size() >= mCapacity)
+    {
+        mIndex.erase(mEntries.back().first);
+        mEntries.pop_back();
+    }
+
+    mEntries.emplace_front(sessionIndex, std::move(channels));
+    mIndex[sessionIndex] = mEntries.begin();
+
+    return mEntries.front().second;
+}
+
+void ChannelCache::clear()
+{
+    mEntries.clear();
+    mIndex.clear();
+}
+
+} // namespace Gamma
@@ -0,0 +1,56 @@
+//  gamma-viewer-3d - 3d visualization of sessions generated by gamma-analyzer
+//  Copyright (C) 2017  Dag Robole
+//
+//  This program is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef CHANNELCACHE_H
+#define CHANNELCACHE_H
+
+#include <cstddef>
+#include <list>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace Gamma
+{
+
+// Least recently used cache of channel arrays, keyed by session index
+class ChannelCache
+{
+public:
+
+    explicit ChannelCache(std::size_t capacity);
+
+    // Returns nullptr on a miss, a hit becomes the most recently used entry
+    const std::vector<int> *find(int sessionIndex);
+    const std::vector<int> &insert(int sessionIndex, std::vector<int> &&channels);
+    void clear();
+
+    std::size_t size() const { return mEntries.size(); }
+    std::size_t capacity() const { return mCapacity; }
+
+private:
+
+    typedef std::list<std::pair<int, std::vector<int>>> EntryList;
+
+    // Most recently used first
+    EntryList mEntries;
+    std::unordered_map<int, EntryList::iterator> mIndex;
+    std::size_t mCapacity;
+};
+
+} // namespace Gamma
+
+#endif // CHANNELCACHE_H
@@ -0,0 +1,210 @@
+//  gamma-viewer-3d - 3d visualization of sessions generated by gamma-analyzer
+//  Copyright (C) 2017  Dag Robole
+//
+//  This program is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "channelparser.h"
+#include "cpufeatures.h"
+#include <climits>
+
+#if defined(_MSC_VER) && !defined(__clang__)
+#include <intrin.h>
+#endif
+
+namespace Gamma
+{
+
+template<typename Char>
+static inline bool isSeparator(Char c)
+{
+    return c == ' ' || c == '\t' || c == '\n' || c == '\r';
+}
+
+template<typename Char>
+static inline bool isDigit(Char c)
+{
+    return c >= '0' && c <= '9';
+}
+
+#ifdef GAMMA_SSE2
+
+static inline unsigned countTrailingZeros(unsigned value)
+{
+#if defined(_MSC_VER) && !defined(__clang__)
+    unsigned long index;
+    _BitScanForward(&index, value);
+    return (unsigned)index;
+#else
+    return (unsigned)__builtin_ctz(value);
+#endif
+}
+
+// Returns the end of the run of digits starting at p, 16 bytes at a time
+static inline const char *scanDigits(const char *p, const char *end)
+{
+    const __m128i zero = _mm_set1_epi8('0');
+    const __m128i nine = _mm_set1_epi8(9);
+
+    while(end - p >= 16)
+    {
+        __m128i v = _mm_sub_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(p)), zero);
+        __m128i digits = _mm_cmpeq_epi8(_mm_min_epu8(v, nine), v);
+        unsigned mask = (unsigned)_mm_movemask_epi8(digits);
+        if(mask != 0xFFFF)
+            return p + countTrailingZeros(~mask);
+        p += 16;
+    }
+
+    while(p < end && isDigit(*p))
+        p++;
+
+    return p;
+}
+
+// Returns the end of the run of digits starting at p, 8 code units at a time
+static inline const unsigned short *scanDigits(const unsigned short *p,
+                                               const unsigned short *end)
+{
+    const __m128i zero = _mm_set1_epi16('0');
+    const __m128i below = _mm_set1_epi16(-1);
+    const __m128i above = _mm_set1_epi16(10);
+
+    while(end - p >= 8)
+    {
+        __m128i v = _mm_sub_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(p)), zero);
+        __m128i digits = _mm_and_si128(_mm_cmpgt_epi16(v, below),
+                                       _mm_cmplt_epi16(v, above));
+        unsigned mask = (unsigned)_mm_movemask_epi8(digits);
+        if(mask != 0xFFFF)
+            return p + countTrailingZeros(~mask) / 2;
+        p += 8;
+    }
+
+    while(p < end && isDigit(*p))
+        p++;
+
+    return p;
+}
+
+#else
+
+template<typename Char>
+static inline const Char *scanDigits(const Char *p, const Char *end)
+{
+    while(p < end && isDigit(*p))
+        p++;
+
+    return p;
+}
+
+#endif // GAMMA_SSE2
+
+template<typename Char>
+static inline int digitsToInt(const Char *p, const Char *end)
+{
+    long long value = 0;
+
+    for(; p < end; p++)
+    {
+        value = value * 10 + (*p - '0');
+        if(value > INT_MAX)
+            return 0;
+    }
+
+    return (int)value;
+}
+
+// Slow path for tokens with a sign or other characters
+template<typename Char>
+static int tokenToInt(const Char *p, const Char *end)
+{
+    bool negative = false;
+
+    if(p < end && (*p == '-' || *p == '+'))
+    {
+        negative = *p == '-';
+        p++;
+    }
+
+    if(p == end)
+        return 0;
+
+    long long value = 0;
+    for(; p < end; p++)
+    {
+        if(!isDigit(*p))
+            return 0;
+
+        value = value * 10 + (*p - '0');
+        if(value > (long long)INT_MAX + 1)
+            return 0;
+    }
+
+    if(negative)
+        return (int)-value;
+
+    return value > INT_MAX ? 0 : (int)value;
+}
+
+template<typename Char>
+static std::size_t parseChannelsImpl(const Char *p,
+                                     const Char *end,
+                                     std::vector<int> &channels)
+{
+    std::size_t count = 0;
+
+    while(true)
+    {
+        while(p < end && isSeparator(*p))
+            p++;
+
+        if(p == end)
+            break;
+
+        const Char *tokenEnd = scanDigits(p, end);
+
+        if(tokenEnd != p && (tokenEnd == end || isSeparator(*tokenEnd)))
+        {
+            channels.push_back(digitsToInt(p, tokenEnd));
+        }
+        else
+        {
+            while(tokenEnd < end && !isSeparator(*tokenEnd))
+                tokenEnd++;
+
+            channels.push_back(tokenToInt(p, tokenEnd));
+        }
+
+        count++;
+        p = tokenEnd;
+    }
+
+    return count;
+}
+
+std::size_t parseChannels(const char *text,
+                          std::size_t length,
+                          std::vector<int> &channels)
+{
+    return parseChannelsImpl(text, text + length, channels);
+}
+
+std::size_t parseChannels(const unsigned short *text,
+                          std::size_t length,
+                          std::vector<int> &channels)
+{
+    return parseChannelsImpl(text, text + length, channels);
+}
+
+} // namespace Gamma
@@ -0,0 +1,41 @@
+//  gamma-viewer-3d - 3d visualization of sessions generated by gamma-analyzer
+//  Copyright (C) 2017  Dag Robole
+//
+//  This program is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef CHANNELPARSER_H
+#define CHANNELPARSER_H
+
+#include <cstddef>
+#include <vector>
+
+namespace Gamma
+{
+
+// Parses whitespace separated channel counts and appends them to channels,
+// returning the number of counts appended. Tokens that are not integers are
+// stored as 0, like QString::toInt does. Reserve channels up front to keep
+// the parser free of allocations.
+std::size_t parseChannels(const char *text,
+                          std::size_t length,
+                          std::vector<int> &channels);
+
+// Same as above for UTF-16 text, as returned by QString::utf16()
+std::size_t parseChannels(const unsigned short *text,
+                          std::size_t length,
+                          std::vector<int> &channels);
+
+} // namespace Gamma
+
+#endif // CHANNELPARSER_H
@@ -0,0 +1,251 @@
+//  gamma-viewer-3d - 3d visualization of sessions generated by gamma-analyzer
+//  Copyright (C) 2017  Dag Robole
+//
+//  This program is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "colormap.h"
+#include "cpufeatures.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+
+namespace Gamma
+{
+
+const ColorRGBA8 ColorMap::NoValueColor = { 0, 255, 0, 255 };
+
+static_assert(sizeof(ColorRGBA8) == 4, "Colors must be packed in 32 bits");
+
+struct MapParameters
+{
+    const ColorRGBA8 *table;
+    double offset;
+    double factor;
+    bool logarithmic;
+    bool zeroHasNoValue;
+};
+
+typedef void (*MapFunction)(const double *, std::size_t, const MapParameters &, ColorRGBA8 *);
+
+// Coefficients of log2(m) = c * (z + z^3 / 3 + ... + z^9 / 9), with
+// z = (m - 1) / (m + 1) for a mantissa m in [1, 2). Good to about 1e-6,
+// which is far below the width of a table entry.
+static const double Log2Series = 2.0 / 0.69314718055994530942;
+
+static double approximateLog2(double value)
+{
+    std::uint64_t bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+
+    double exponent = (double)(int)(bits >> 52) - 1023.0;
+    bits = (bits & 0x000fffffffffffffULL) | 0x3ff0000000000000ULL;
+
+    double m;
+    std::memcpy(&m, &bits, sizeof(m));
+
+    double z = (m - 1.0) / (m + 1.0);
+    double z2 = z * z;
+    double series = 1.0 + z2 * (1.0 / 3.0 + z2 * (1.0 / 5.0 + z2 * (1.0 / 7.0 + z2 * (1.0 / 9.0))));
+
+    return exponent + Log2Series * z * series;
+}
+
+static void mapScalar(const double *values,
+                      std::size_t count,
+                      const MapParameters &p,
+                      ColorRGBA8 *colors)
+{
+    const double last = ColorMap::Size - 1;
+
+    for(std::size_t i = 0; i < count; i++)
+    {
+        double value = values[i];
+        bool noValue = !(value == value)
+                || (p.zeroHasNoValue && value == 0.0)
+                || (p.logarithmic && value <= 0.0);
+
+        int index = ColorMap::Size;
+        if(!noValue)
+        {
+            double t = p.logarithmic ? approximateLog2(value) : value;
+            double f = std::min(std::max((t - p.offset) * p.factor, 0.0), last);
+            index = (int)(f + 0.5);
+        }
+
+        colors[i] = p.table[index];
+    }
+}
+
+#ifdef GAMMA_X86
+
+GAMMA_TARGET_AVX2
+static void mapAVX2(const double *values,
+                    std::size_t count,
+                    const MapParameters &p,
+                    ColorRGBA8 *colors)
+{
+    const __m256d zero = _mm256_setzero_pd();
+    const __m256d one = _mm256_set1_pd(1.0);
+    const __m256d half = _mm256_set1_pd(0.5);
+    const __m256d last = _mm256_set1_pd(ColorMap::Size - 1);
+    const __m256d noValueIndex = _mm256_set1_pd(ColorMap::Size);
+    const __m256d offset = _mm256_set1_pd(p.offset);
+    const __m256d factor = _mm256_set1_pd(p.factor);
+
+    // Exponents are turned into doubles by way of the 2^52 bit pattern
+    const __m256i mantissaMask = _mm256_set1_epi64x(0x000fffffffffffffLL);
+    const __m256i mantissaOne = _mm256_set1_epi64x(0x3ff0000000000000LL);
+    const __m256i magic = _mm256_set1_epi64x(0x4330000000000000LL);
+    const __m256d magicBias = _mm256_set1_pd(4503599627370496.0 + 1023.0);
+    const __m256d series = _mm256_set1_pd(Log2Series);
+
+    const int *table = reinterpret_cast<const int*>(p.table);
+
+    std::size_t i = 0;
+    for(; i + 4 <= count; i += 4)
+    {
+        __m256d value = _mm256_loadu_pd(values + i);
+
+        __m256d noValue = _mm256_cmp_pd(value, value, _CMP_UNORD_Q);
+        if(p.zeroHasNoValue)
+            noValue = _mm256_or_pd(noValue, _mm256_cmp_pd(value, zero, _CMP_EQ_OQ));
+
+        __m256d t = value;
+        if(p.logarithmic)
+        {
+            noValue = _mm256_or_pd(noValue, _mm256_cmp_pd(value, zero, _CMP_LE_OQ));
+
+            __m256i bits = _mm256_castpd_si256(value);
+            __m256d exponent = _mm256_sub_pd(
+                        _mm256_castsi256_pd(_mm256_or_si256(_mm256_srli_epi64(bits, 52), magic)),
+                        magicBias);
+            __m256d m = _mm256_castsi256_pd(
+                        _mm256_or_si256(_mm256_and_si256(bits, mantissaMask), mantissaOne));
+
+            __m256d z = _mm256_div_pd(_mm256_sub_pd(m, one), _mm256_add_pd(m, one));
+            __m256d z2 = _mm256_mul_pd(z, z);
+            __m256d s = _mm256_set1_pd(1.0 / 9.0);
+            s = _mm256_fmadd_pd(s, z2, _mm256_set1_pd(1.0 / 7.0));
+            s = _mm256_fmadd_pd(s, z2, _mm256_set1_pd(1.0 / 5.0));
+            s = _mm256_fmadd_pd(s, z2, _mm256_set1_pd(1.0 / 3.0));
+            s = _mm256_fmadd_pd(s, z2, one);
+
+            t = _mm256_fmadd_pd(_mm256_mul_pd(series, z), s, exponent);
+        }
+
+        __m256d f = _mm256_mul_pd(_mm256_sub_pd(t, offset), factor);
+        f = _mm256_min_pd(_mm256_max_pd(f, zero), last);
+        f = _mm256_blendv_pd(_mm256_add_pd(f, half), noValueIndex, noValue);
+
+        __m128i index = _mm256_cvttpd_epi32(f);
+        __m128i rgba = _mm_i32gather_epi32(table, index, 4);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(colors + i), rgba);
+    }
+
+    mapScalar(values + i, count - i, p, colors + i);
+}
+
+#endif // GAMMA_X86
+
+static MapFunction selectMapFunction()
+{
+#ifdef GAMMA_X86
+    if(cpuSupportsAVX2())
+        return mapAVX2;
+#endif
+    return mapScalar;
+}
+
+const ColorMap &ColorMap::instance()
+{
+    static const ColorMap map;
+    return map;
+}
+
+ColorMap::ColorMap()
+{
+    for(int i = 0; i < Size; i++)
+    {
+        // Same ramp as the per-spectrum colours used to be made with
+        double f = (double)i / (Size - 1);
+        double a = (1.0 - f) / 0.25;    // invert and group
+        double x = std::floor(a);       // the integer part
+        auto y = (unsigned char)std::floor(255.0 * (a - x)); // the fractional part from 0 to 255
+
+        ColorRGBA8 &color = mTable[i];
+        color.a = 255;
+
+        switch((int)x)
+        {
+        case 0:
+            color.r = 255; color.g = y; color.b = 0;
+            break;
+        case 1:
+            color.r = 255 - y; color.g = 255; color.b = 0;
+            break;
+        case 2:
+            color.r = 0; color.g = 255; color.b = y;
+            break;
+        case 3:
+            color.r = 0; color.g = 255 - y; color.b = 255;
+            break;
+        default:
+            color.r = 0; color.g = 0; color.b = 255;
+            break;
+        }
+    }
+
+    mTable[Size] = NoValueColor;
+}
+
+ColorRGBA8 ColorMap::color(double f) const
+{
+    f = std::min(std::max(f, 0.0), 1.0);
+    return mTable[(int)(f * (Size - 1) + 0.5)];
+}
+
+void ColorMap::map(const double *values,
+                   std::size_t count,
+                   double minValue,
+                   double maxValue,
+                   Scale scale,
+                   bool zeroHasNoValue,
+                   ColorRGBA8 *colors) const
+{
+    bool logarithmic = scale == Logarithmic;
+    if(logarithmic && (minValue <= 0.0 || maxValue <= 0.0))
+        maxValue = minValue;
+
+    if(!(maxValue > minValue))
+    {
+        std::fill(colors, colors + count, NoValueColor);
+        return;
+    }
+
+    // Bounds go through the same approximation as the values, so both ends
+    // land on the first and last entries
+    MapParameters p;
+    p.table = mTable;
+    p.offset = logarithmic ? approximateLog2(minValue) : minValue;
+    double high = logarithmic ? approximateLog2(maxValue) : maxValue;
+    p.factor = (Size - 1) / (high - p.offset);
+    p.logarithmic = logarithmic;
+    p.zeroHasNoValue = zeroHasNoValue;
+
+    static const MapFunction function = selectMapFunction();
+    function(values, count, p, colors);
+}
+
+} // namespace Gamma
@@ -0,0 +1,73 @@
+//  gamma-viewer-3d - 3d visualization of sessions generated by gamma-analyzer
+//  Copyright (C) 2017  Dag Robole
+//
+//  This program is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef COLORMAP_H
+#define COLORMAP_H
+
+#include <cstddef>
+
+namespace Gamma
+{
+
+// Packed colour as laid out in the instance buffers, red in the first byte
+struct ColorRGBA8
+{
+    unsigned char r, g, b, a;
+};
+
+// Precomputed colour ramp for spectra, from blue at the low end through
+// cyan, green and yellow to red at the high end
+class ColorMap
+{
+public:
+
+    enum Scale
+    {
+        Linear,
+        Logarithmic
+    };
+
+    static const ColorMap &instance();
+
+    // Colour at f from 0 to 1, f is clamped
+    ColorRGBA8 color(double f) const;
+
+    // Maps count values onto the ramp between minValue and maxValue in one
+    // pass. NaN values, values that can not be scaled and all values of an
+    // empty range get NoValueColor, zeros as well when zeroHasNoValue is set.
+    // A logarithmic scale needs a positive minValue.
+    void map(const double *values,
+             std::size_t count,
+             double minValue,
+             double maxValue,
+             Scale scale,
+             bool zeroHasNoValue,
+             ColorRGBA8 *colors) const;
+
+    static const int Size = 1024;
+    static const ColorRGBA8 NoValueColor;
+
+private:
+
+    ColorMap();
+
+    // The entry after the ramp holds NoValueColor
+    ColorRGBA8 mTable[Size + 1];
+};
+
+} // namespace Gamma
+
+#endif // COLORMAP_H
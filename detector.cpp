@@ -16,7 +16,6 @@
 
 #include "detector.h"
 #include "exceptions.h"
-#include <cmath>
 #include <QJsonArray>
 
 namespace Gamma
@@ -92,21 +91,42 @@ void Detector::loadJson(const QJsonObject &obj)
     mEnergyCurveCoefficients.clear();
     for(auto c : coeffs)
         mEnergyCurveCoefficients.emplace_back(c.toDouble());
+
+    updateEnergyTable();
 }
 
 double Detector::getEnergy(int channel) const
+{
+    if(channel < 0)
+        return 0.0;
+
+    if((std::size_t)channel < mEnergyTable.size())
+        return mEnergyTable[channel];
+
+    return calculateEnergy((double)channel);
+}
+
+double Detector::calculateEnergy(double channel) const
 {
     if (mEnergyCurveCoefficients.size() < 2 ||
-            mEnergyCurveCoefficients.size() > 5 || channel < 0)
+            mEnergyCurveCoefficients.size() > 5)
         return 0.0;
 
+    // Horner's scheme, highest order coefficient first
     double energy = 0.0;
 
-    for(CoefficientListSize i = 0; i < mEnergyCurveCoefficients.size(); i++)
-        energy += mEnergyCurveCoefficients[i] *
-                std::pow((double)channel, (double)i);
+    for(auto it = mEnergyCurveCoefficients.rbegin(); it != mEnergyCurveCoefficients.rend(); ++it)
+        energy = energy * channel + *it;
 
     return energy;
 }
 
+void Detector::updateEnergyTable()
+{
+    mEnergyTable.resize(mNumChannels > 0 ? (std::size_t)mNumChannels : 0);
+
+    for(std::size_t i = 0; i < mEnergyTable.size(); i++)
+        mEnergyTable[i] = calculateEnergy((double)i);
+}
+
 } // namespace Gamma
@@ -26,6 +26,7 @@ namespace Gamma
 
 typedef std::vector<double> CoefficientList;
 typedef CoefficientList::size_type CoefficientListSize;
+typedef std::vector<double> EnergyList;
 
 class Detector
 {
@@ -57,6 +58,9 @@ public:
 
     double getEnergy(int index) const;
 
+    // Energy of every channel, numChannels entries, rebuilt by loadJson
+    const EnergyList &energyTable() const { return mEnergyTable; }
+
 private:
 
     QString mTypeName, mGEScript;
@@ -68,6 +72,10 @@ private:
     int mLLD, mULD;
     QString mPluginName;
     CoefficientList mEnergyCurveCoefficients;
+    EnergyList mEnergyTable;
+
+    double calculateEnergy(double channel) const;
+    void updateEnergyTable();
 };
 
 } // namespace Gamma
@@ -0,0 +1,263 @@
+//  gamma-viewer-3d - 3d visualization of sessions generated by gamma-analyzer
+//  Copyright (C) 2017  Dag Robole
+//
+//  This program is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "doseratekernel.h"
+#include "cpufeatures.h"
+#include "geweighttable.h"
+#include <algorithm>
+#include <limits>
+
+namespace Gamma
+{
+
+typedef double (*WeightedSumFunction)(const int *, const double *, int);
+typedef void (*StackedSumFunction)(const int *, const double *, int, std::size_t, double *);
+
+// Adds count channels times the stacked weight rows to sums, stride wide
+static void stackedChannelSumScalar(const int *channels,
+                                    const double *rows,
+                                    int count,
+                                    std::size_t stride,
+                                    double *sums)
+{
+    for(int i = 0; i < count; i++)
+    {
+        double c = channels[i];
+        const double *row = rows + (std::size_t)i * stride;
+
+        for(std::size_t m = 0; m < stride; m++)
+            sums[m] += c * row[m];
+    }
+}
+
+static double weightedChannelSumScalar(const int *channels,
+                                       const double *weights,
+                                       int count)
+{
+    double sum = 0.0;
+
+    for(int i = 0; i < count; i++)
+        sum += weights[i] * channels[i];
+
+    return sum;
+}
+
+#ifdef GAMMA_X86
+
+GAMMA_TARGET_AVX2
+static double weightedChannelSumAVX2(const int *channels,
+                                     const double *weights,
+                                     int count)
+{
+    // Two accumulators to hide the FMA latency
+    __m256d acc0 = _mm256_setzero_pd();
+    __m256d acc1 = _mm256_setzero_pd();
+
+    int i = 0;
+    for(; i + 8 <= count; i += 8)
+    {
+        __m256d c0 = _mm256_cvtepi32_pd(
+                    _mm_loadu_si128(reinterpret_cast<const __m128i*>(channels + i)));
+        __m256d c1 = _mm256_cvtepi32_pd(
+                    _mm_loadu_si128(reinterpret_cast<const __m128i*>(channels + i + 4)));
+
+        acc0 = _mm256_fmadd_pd(c0, _mm256_loadu_pd(weights + i), acc0);
+        acc1 = _mm256_fmadd_pd(c1, _mm256_loadu_pd(weights + i + 4), acc1);
+    }
+
+    acc0 = _mm256_add_pd(acc0, acc1);
+    __m128d sum2 = _mm_add_pd(_mm256_castpd256_pd128(acc0),
+                              _mm256_extractf128_pd(acc0, 1));
+    sum2 = _mm_add_sd(sum2, _mm_unpackhi_pd(sum2, sum2));
+    double sum = _mm_cvtsd_f64(sum2);
+
+    for(; i < count; i++)
+        sum += weights[i] * channels[i];
+
+    return sum;
+}
+
+GAMMA_TARGET_AVX2
+static void stackedChannelSumAVX2(const int *channels,
+                                  const double *rows,
+                                  int count,
+                                  std::size_t stride,
+                                  double *sums)
+{
+    // Up to 16 models are kept in registers, wider stacks take more passes
+    const std::size_t GroupsPerPass = 4;
+    std::size_t groups = stride / 4;
+
+    for(std::size_t g0 = 0; g0 < groups; g0 += GroupsPerPass)
+    {
+        std::size_t passGroups = std::min(GroupsPerPass, groups - g0);
+        __m256d acc[GroupsPerPass];
+        for(std::size_t g = 0; g < passGroups; g++)
+            acc[g] = _mm256_loadu_pd(sums + (g0 + g) * 4);
+
+        for(int i = 0; i < count; i++)
+        {
+            __m256d c = _mm256_set1_pd((double)channels[i]);
+            const double *row = rows + (std::size_t)i * stride + g0 * 4;
+
+            for(std::size_t g = 0; g < passGroups; g++)
+                acc[g] = _mm256_fmadd_pd(c, _mm256_loadu_pd(row + g * 4), acc[g]);
+        }
+
+        for(std::size_t g = 0; g < passGroups; g++)
+            _mm256_storeu_pd(sums + (g0 + g) * 4, acc[g]);
+    }
+}
+
+#endif // GAMMA_X86
+
+static StackedSumFunction selectStackedSum()
+{
+#ifdef GAMMA_X86
+    if(cpuSupportsAVX2())
+        return stackedChannelSumAVX2;
+#endif
+    return stackedChannelSumScalar;
+}
+
+static WeightedSumFunction selectWeightedSum()
+{
+#ifdef GAMMA_X86
+    if(cpuSupportsAVX2())
+        return weightedChannelSumAVX2;
+#endif
+    return weightedChannelSumScalar;
+}
+
+static WeightedSumFunction weightedSumFunction()
+{
+    static const WeightedSumFunction function = selectWeightedSum();
+    return function;
+}
+
+double weightedChannelSum(const int *channels, const double *weights, int count)
+{
+    if(count <= 0)
+        return 0.0;
+
+    return weightedSumFunction()(channels, weights, count);
+}
+
+void calculateDoserates(const int *channels,
+                        const std::size_t *offsets,
+                        const int *livetimes,
+                        std::size_t count,
+                        const GEWeightTable &weightTable,
+                        double *doserates)
+{
+    WeightedSumFunction weightedSum = weightedSumFunction();
+    const double *weights = weightTable.weights().data();
+    int startChan = weightTable.startChannel();
+
+    for(std::size_t i = 0; i < count; i++)
+    {
+        // Spectra shorter than the discriminator window are cut at their end
+        int endChan = weightTable.endChannel();
+        int numChannels = (int)(offsets[i + 1] - offsets[i]);
+        if(endChan > numChannels)
+            endChan = numChannels;
+
+        double sum = 0.0;
+        if(endChan > startChan)
+            sum = weightedSum(channels + offsets[i] + startChan,
+                              weights + startChan,
+                              endChan - startChan);
+
+        double sec = (double)livetimes[i] / 1000000.0;
+        doserates[i] = sum / sec * 60.0;
+    }
+}
+
+StackedWeights::StackedWeights(const std::vector<const GEWeightTable*> &tables)
+    :
+      mModelCount(tables.size()),
+      mStride((tables.size() + 3) & ~(std::size_t)3),
+      mStartChannel(std::numeric_limits<int>::max()),
+      mEndChannel(0)
+{
+    for(auto table : tables)
+    {
+        if(!table || table->endChannel() <= table->startChannel())
+            continue;
+        mStartChannel = std::min(mStartChannel, table->startChannel());
+        mEndChannel = std::max(mEndChannel, table->endChannel());
+    }
+
+    if(mEndChannel <= mStartChannel)
+        mStartChannel = mEndChannel = 0;
+
+    mWeights.assign((std::size_t)(mEndChannel - mStartChannel) * mStride, 0.0);
+
+    // Channels outside the window of a model keep a zero weight
+    for(std::size_t m = 0; m < tables.size(); m++)
+    {
+        if(!tables[m])
+            continue;
+
+        for(int i = tables[m]->startChannel(); i < tables[m]->endChannel(); i++)
+            mWeights[(std::size_t)(i - mStartChannel) * mStride + m] = tables[m]->weights()[i];
+    }
+}
+
+void calculateDoserates(const int *channels,
+                        const std::size_t *offsets,
+                        const int *livetimes,
+                        std::size_t count,
+                        const StackedWeights &weights,
+                        double *doserates)
+{
+    static const StackedSumFunction stackedSum = selectStackedSum();
+
+    std::size_t models = weights.modelCount();
+    int startChan = weights.startChannel();
+    std::vector<double> sums(weights.stride());
+
+    for(std::size_t i = 0; i < count; i++)
+    {
+        int endChan = weights.endChannel();
+        int numChannels = (int)(offsets[i + 1] - offsets[i]);
+        if(endChan > numChannels)
+            endChan = numChannels;
+
+        std::fill(sums.begin(), sums.end(), 0.0);
+        if(endChan > startChan)
+            stackedSum(channels + offsets[i] + startChan,
+                       weights.row(startChan),
+                       endChan - startChan,
+                       weights.stride(),
+                       sums.data());
+
+        double sec = (double)livetimes[i] / 1000000.0;
+        for(std::size_t m = 0; m < models; m++)
+            doserates[i * models + m] = sums[m] / sec * 60.0;
+    }
+}
+
+const char *doserateKernelName()
+{
+#ifdef GAMMA_X86
+    if(weightedSumFunction() == weightedChannelSumAVX2)
+        return "AVX2";
+#endif
+    return "scalar";
+}
+
+} // namespace Gamma
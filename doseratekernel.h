@@ -0,0 +1,82 @@
+//  gamma-viewer-3d - 3d visualization of sessions generated by gamma-analyzer
+//  Copyright (C) 2017  Dag Robole
+//
+//  This program is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef DOSERATEKERNEL_H
+#define DOSERATEKERNEL_H
+
+#include <cstddef>
+#include <vector>
+
+namespace Gamma
+{
+
+class GEWeightTable;
+
+// Calculates doserates for a batch of spectra stored as rows in a flat
+// channel matrix, row i spans channels[offsets[i]] to channels[offsets[i + 1]].
+// Livetimes are in microseconds, as stored in the session database.
+void calculateDoserates(const int *channels,
+                        const std::size_t *offsets,
+                        const int *livetimes,
+                        std::size_t count,
+                        const GEWeightTable &weightTable,
+                        double *doserates);
+
+// Weight tables of several dose models interleaved per channel, so a single
+// pass over the channels of a spectrum updates the sums of every model.
+// Rows are padded to a multiple of four models, a null table gives zeros.
+class StackedWeights
+{
+public:
+
+    explicit StackedWeights(const std::vector<const GEWeightTable*> &tables);
+
+    std::size_t modelCount() const { return mModelCount; }
+    std::size_t stride() const { return mStride; }
+    int startChannel() const { return mStartChannel; }
+    int endChannel() const { return mEndChannel; }
+
+    // Weights of all models for a channel in the start..end window
+    const double *row(int channel) const
+    {
+        return mWeights.data() + (std::size_t)(channel - mStartChannel) * mStride;
+    }
+
+private:
+
+    std::size_t mModelCount;
+    std::size_t mStride;
+    int mStartChannel;
+    int mEndChannel;
+    std::vector<double> mWeights;
+};
+
+// Same as above for several models, doserates is a count x modelCount matrix
+void calculateDoserates(const int *channels,
+                        const std::size_t *offsets,
+                        const int *livetimes,
+                        std::size_t count,
+                        const StackedWeights &weights,
+                        double *doserates);
+
+// Weighted channel sum used for each row, dispatched to AVX2 when available
+double weightedChannelSum(const int *channels, const double *weights, int count);
+
+const char *doserateKernelName();
+
+} // namespace Gamma
+
+#endif // DOSERATEKERNEL_H
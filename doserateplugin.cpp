@@ -0,0 +1,190 @@
+//  gamma-viewer-3d - 3d visualization of sessions generated by gamma-analyzer
+//  Copyright (C) 2017  Dag Robole
+//
+//  This program is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "doserateplugin.h"
+#include "exceptions.h"
+#include <map>
+#include <mutex>
+#include <vector>
+#include <QFileInfo>
+#include <QCryptographicHash>
+
+namespace Gamma
+{
+
+void DoseratePlugin::GEValues(const double *energies,
+                              double *weights,
+                              std::size_t count) const
+{
+    for(std::size_t i = 0; i < count; i++)
+        weights[i] = GEValue(energies[i]);
+}
+
+QString DoseratePlugin::fingerprint() const
+{
+    // 1 keV steps up to 3 MeV cover the channels of every supported detector
+    const std::size_t count = 3000;
+    std::vector<double> energies(count), weights(count);
+    for(std::size_t i = 0; i < count; i++)
+        energies[i] = (i + 1) / 1000.0;
+
+    GEValues(energies.data(), weights.data(), count);
+
+    QByteArray data(reinterpret_cast<const char*>(weights.data()),
+                    (int)(count * sizeof(double)));
+    return QString::fromLatin1(
+                QCryptographicHash::hash(data, QCryptographicHash::Sha1).toHex().left(16));
+}
+
+template<std::size_t N>
+static double polynomial(const double (&coefficients)[N], double x)
+{
+    // Coefficients are ordered from the highest degree down
+    double y = coefficients[0];
+    for(std::size_t i = 1; i < N; i++)
+        y = y * x + coefficients[i];
+    return y;
+}
+
+// Same response curves as scripts/osprey-nai2.lua
+class OspreyNaI2Plugin : public DoseratePlugin
+{
+public:
+
+    QString name() const override { return "osprey-nai2"; }
+
+    double GEValue(double energy) const override
+    {
+        static const double low[] = {
+            -16772.0, 7316.5, -1268.6, 109.49, -4.7059, 0.0822
+        };
+        static const double high[] = {
+            0.0013, -0.0142, 0.0629, -0.138, 0.1441, -0.0197, 0.0028
+        };
+
+        return energy <= 0.11 ? polynomial(low, energy) : polynomial(high, energy);
+    }
+};
+
+// Same response curves as scripts/osprey-nai3.lua
+class OspreyNaI3Plugin : public DoseratePlugin
+{
+public:
+
+    QString name() const override { return "osprey-nai3"; }
+
+    double GEValue(double energy) const override
+    {
+        static const double low[] = {
+            -22.609, 5.3102, -0.4109, 0.0112
+        };
+        static const double high[] = {
+            -0.0005, 0.0046, -0.015, 0.0197, 0.0035, 0.0002
+        };
+
+        return energy <= 0.09 ? polynomial(low, energy) : polynomial(high, energy);
+    }
+};
+
+typedef std::map<QString, DoseratePluginPointer> PluginRegistry;
+
+static QString makePluginKey(QString name)
+{
+    name = name.trimmed().toLower();
+    if(name.endsWith(".lua"))
+        name = QFileInfo(name).completeBaseName();
+    return name;
+}
+
+static std::mutex &registryMutex()
+{
+    static std::mutex mutex;
+    return mutex;
+}
+
+static PluginRegistry &registry()
+{
+    static PluginRegistry plugins = []() {
+        PluginRegistry builtin;
+        builtin["osprey-nai2"] = std::make_shared<const OspreyNaI2Plugin>();
+        builtin["osprey-nai3"] = std::make_shared<const OspreyNaI3Plugin>();
+        return builtin;
+    }();
+
+    return plugins;
+}
+
+void registerDoseratePlugin(DoseratePluginPointer plugin)
+{
+    if(!plugin)
+        throw Exception_InvalidPointer("registerDoseratePlugin: plugin");
+
+    std::lock_guard<std::mutex> lock(registryMutex());
+    registry()[makePluginKey(plugin->name())] = std::move(plugin);
+}
+
+QStringList doseratePluginNames()
+{
+    std::lock_guard<std::mutex> lock(registryMutex());
+
+    QStringList names;
+    for(auto &p : registry())
+        names << p.second->name();
+
+    return names;
+}
+
+QString doseratePluginsKey()
+{
+    std::vector<DoseratePluginPointer> plugins;
+    {
+        std::lock_guard<std::mutex> lock(registryMutex());
+        for(auto &p : registry())
+            plugins.push_back(p.second);
+    }
+
+    QStringList keys;
+    for(auto &plugin : plugins)
+        keys << plugin->name() + '@' + plugin->fingerprint();
+
+    return keys.join(';');
+}
+
+DoseratePluginPointer findDoseratePlugin(QString name)
+{
+    std::lock_guard<std::mutex> lock(registryMutex());
+
+    auto it = registry().find(makePluginKey(name));
+    return it != registry().end() ? it->second : nullptr;
+}
+
+DoseratePluginPointer findDoseratePlugin(const Detector &detector)
+{
+    for(auto name : { QFileInfo(detector.GEScript()).fileName(),
+                      detector.pluginName(),
+                      detector.typeName() })
+    {
+        if(name.isEmpty())
+            continue;
+
+        if(auto plugin = findDoseratePlugin(name))
+            return plugin;
+    }
+
+    return nullptr;
+}
+
+} // namespace Gamma
@@ -0,0 +1,69 @@
+//  gamma-viewer-3d - 3d visualization of sessions generated by gamma-analyzer
+//  Copyright (C) 2017  Dag Robole
+//
+//  This program is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef DOSERATEPLUGIN_H
+#define DOSERATEPLUGIN_H
+
+#include "detector.h"
+#include <cstddef>
+#include <memory>
+#include <QString>
+#include <QStringList>
+
+namespace Gamma
+{
+
+class DoseratePlugin;
+
+typedef std::shared_ptr<const DoseratePlugin> DoseratePluginPointer;
+
+// Compiled counterpart of a doserate script, GE values for energies in MeV
+class DoseratePlugin
+{
+public:
+
+    virtual ~DoseratePlugin() = default;
+
+    virtual QString name() const = 0;
+    virtual double GEValue(double energy) const = 0;
+    virtual void GEValues(const double *energies,
+                          double *weights,
+                          std::size_t count) const;
+
+    // Hash of the response sampled over the energy range. Cached doserates
+    // are keyed by it, so they go stale whenever the coefficients change.
+    QString fingerprint() const;
+};
+
+// Registering a plugin under an existing name replaces it, sessions keep
+// using the plugin they were given
+void registerDoseratePlugin(DoseratePluginPointer plugin);
+QStringList doseratePluginNames();
+
+// Names and fingerprints of all registered plugins, for caches that must be
+// keyed before the detector of a session is known
+QString doseratePluginsKey();
+
+// Names are matched without case and without a .lua suffix
+DoseratePluginPointer findDoseratePlugin(QString name);
+
+// Tries the GE script of the detector first, then its plugin and type name.
+// Returns null for detectors without a compiled plugin.
+DoseratePluginPointer findDoseratePlugin(const Detector &detector);
+
+} // namespace Gamma
+
+#endif // DOSERATEPLUGIN_H
@@ -14,6 +14,14 @@ CONFIG += c++14
 # deprecated API in order to know how to port your code away from it.
 DEFINES += QT_DEPRECATED_WARNINGS
 
+# Read session databases with sqlite3 directly when the library is available,
+# the Qt SQL driver is used otherwise
+CONFIG += link_pkgconfig
+packagesExist(sqlite3) {
+    PKGCONFIG += sqlite3
+    DEFINES += GAMMA_HAVE_SQLITE3
+}
+
 # You can also make your code fail to compile if you use deprecated APIs.
 # In order to do so, uncomment the following line.
 # You can also select to disable deprecated APIs only up to a certain version of Qt.
@@ -54,11 +62,31 @@ SOURCES += lua/lapi.c \
     lua/lzio.c \
     main.cpp \
     session.cpp \
+    sessionloader.cpp \
+    sessioncache.cpp \
+    sessionreader.cpp \
+    loadstatistics.cpp \
     spectrum.cpp \
+    spectrumstore.cpp \
     geo.cpp \
     detector.cpp \
+    cpufeatures.cpp \
+    channelparser.cpp \
+    channelcache.cpp \
+    doseratekernel.cpp \
+    colormap.cpp \
+    geweighttable.cpp \
+    doserateplugin.cpp \
+    luastate.cpp \
+    luaarena.cpp \
+    luachunkcache.cpp \
+    luasession.cpp \
+    luabuffer.cpp \
     scene.cpp \
-    spectrumentity.cpp \
+    spectrummarkerentity.cpp \
+    markerbvh.cpp \
+    markeroctree.cpp \
+    markermaterial.cpp \
     gridentity.cpp \
     selectionentity.cpp \
     compassentity.cpp \
@@ -90,12 +118,33 @@ HEADERS += lua/lapi.h \
     lua/lvm.h \
     lua/lzio.h \
     session.h \
+    sessionloader.h \
+    sessionbounds.h \
+    sessioncache.h \
+    sessionreader.h \
+    loadstatistics.h \
     spectrum.h \
+    spectrumstore.h \
     geo.h \
     detector.h \
+    cpufeatures.h \
+    channelparser.h \
+    channelcache.h \
+    doseratekernel.h \
+    colormap.h \
+    geweighttable.h \
+    doserateplugin.h \
+    luastate.h \
+    luaarena.h \
+    luachunkcache.h \
+    luasession.h \
+    luabuffer.h \
     exceptions.h \
     scene.h \
-    spectrumentity.h \
+    spectrummarkerentity.h \
+    markerbvh.h \
+    markeroctree.h \
+    markermaterial.h \
     gridentity.h \
     selectionentity.h \
     compassentity.h \
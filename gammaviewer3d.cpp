@@ -21,21 +21,27 @@
 #include "scene.h"
 #include "gridentity.h"
 #include "compassentity.h"
-#include "spectrumentity.h"
+#include "spectrummarkerentity.h"
 #include "selectionentity.h"
 #include <exception>
 #include <algorithm>
+#include <numeric>
 #include <QDebug>
 #include <QMessageBox>
 #include <QDir>
+#include <QFile>
+#include <QFileInfo>
 #include <QFileDialog>
+#include <QSignalBlocker>
 #include <QAction>
+#include <QThread>
+#include <QMouseEvent>
+#include <QToolTip>
 #include <QColor>
 #include <QVector3D>
 #include <QGeoCoordinate>
 #include <Qt3DCore/QEntity>
 #include <Qt3DRender/QCamera>
-#include <Qt3DRender/QObjectPicker>
 
 GammaViewer3D::GammaViewer3D(QWidget *parent)
     :
@@ -63,6 +69,26 @@ void GammaViewer3D::setupWidgets()
 {
     labelStatus = new QLabel(statusBar());
     statusBar()->addWidget(labelStatus);
+
+    progressLoading = new QProgressBar(statusBar());
+    progressLoading->setMaximumWidth(200);
+    progressLoading->setVisible(false);
+    statusBar()->addPermanentWidget(progressLoading);
+
+    ui->actionCancelLoading->setEnabled(false);
+    ui->actionApplyDoserateScript->setEnabled(false);
+
+    // Bursts of writes to a followed session are read in one go
+    sessionWatcher = new QFileSystemWatcher(this);
+    followTimer = new QTimer(this);
+    followTimer->setSingleShot(true);
+    followTimer->setInterval(500);
+
+    // Every loaded doserate script is a dose model to color by
+    comboDoseModel = new QComboBox(ui->mainToolBar);
+    comboDoseModel->setToolTip(tr("Dose model"));
+    comboDoseModel->setEnabled(false);
+    ui->mainToolBar->addWidget(comboDoseModel);
 }
 
 void GammaViewer3D::setupSignals()
@@ -77,16 +103,81 @@ void GammaViewer3D::setupSignals()
                      this,
                      &GammaViewer3D::onLoadDoserateScript);
 
+    QObject::connect(ui->actionApplyDoserateScript,
+                     &QAction::triggered,
+                     this,
+                     &GammaViewer3D::onApplyDoserateScript);
+
+    QObject::connect(ui->actionRunAnalysisScript,
+                     &QAction::triggered,
+                     this,
+                     &GammaViewer3D::onRunAnalysisScript);
+
+    QObject::connect(ui->actionColorByDoserate,
+                     &QAction::triggered,
+                     this,
+                     &GammaViewer3D::onColorByDoserate);
+
+    QObject::connect(comboDoseModel,
+                     static_cast<void (QComboBox::*)(int)>(&QComboBox::currentIndexChanged),
+                     this,
+                     &GammaViewer3D::onDoseModelChanged);
+
     QObject::connect(ui->actionOpenSession,
                      &QAction::triggered,
                      this,
                      &GammaViewer3D::onOpenSession);
+
+    QObject::connect(ui->actionCancelLoading,
+                     &QAction::triggered,
+                     this,
+                     &GammaViewer3D::onCancelLoading);
+
+    QObject::connect(ui->actionFollowSessions,
+                     &QAction::toggled,
+                     this,
+                     &GammaViewer3D::onFollowSessions);
+
+    QObject::connect(ui->actionSphereMarkers,
+                     &QAction::toggled,
+                     this,
+                     &GammaViewer3D::onMarkerStyleChanged);
+
+    QObject::connect(ui->actionScreenSizedMarkers,
+                     &QAction::toggled,
+                     this,
+                     &GammaViewer3D::onMarkerStyleChanged);
+
+    QObject::connect(sessionWatcher,
+                     &QFileSystemWatcher::fileChanged,
+                     this,
+                     &GammaViewer3D::onSessionFileChanged);
+
+    QObject::connect(sessionWatcher,
+                     &QFileSystemWatcher::directoryChanged,
+                     this,
+                     &GammaViewer3D::onSessionFileChanged);
+
+    QObject::connect(followTimer,
+                     &QTimer::timeout,
+                     this,
+                     &GammaViewer3D::onFollowTimeout);
 }
 
 void GammaViewer3D::onActionExit()
 {
     try
     {
+        // Loaders write into their sessions, stop them before the scenes go
+        for(auto &p : loaders)
+        {
+            QThread *thread = p.first->thread();
+            p.first->cancel();
+            thread->quit();
+            thread->wait();
+        }
+        loaders.clear();
+
         scenes.clear();
         QApplication::exit();
     }
@@ -96,78 +187,453 @@ void GammaViewer3D::onActionExit()
     }
 }
 
-static QVector3D makeScenePosition(const Gamma::Session &session,
-                                   const QVector3D &position,
-                                   double altitude)
-{
-    return QVector3D(position.x() - session.minX() - session.halfX(),
-                     altitude - session.minAltitude(),
-                     -(position.y() - session.minY() - session.halfY()));
-}
-
-static QVector3D makeScenePosition(const Gamma::Session &session,
+static QVector3D makeScenePosition(const Scene &scene,
                                    const Gamma::Spectrum &spec)
 {
-    return makeScenePosition(session,
-                             spec.position,
-                             spec.coordinate.altitude());
+    return scene.makeScenePosition(spec.position(),
+                                   spec.altitude());
 }
 
 void GammaViewer3D::onOpenSession()
 {
     try
     {
-        auto sessionFileName = QFileDialog::getOpenFileName(
+        auto sessionFileNames = QFileDialog::getOpenFileNames(
                     this,
-                    tr("Open session database"),
+                    tr("Open session databases"),
                     QDir::homePath(),
                     tr("SQLite DB (*.db);; All files (*.*)"));
-        if(sessionFileName.isEmpty())
-            return;
 
-        sessionFileName = QDir::toNativeSeparators(sessionFileName);
+        // Every session loads on its own thread with its own connection
+        for(auto sessionFileName : sessionFileNames)
+        {
+            sessionFileName = QDir::toNativeSeparators(sessionFileName);
+            if(isLoading(sessionFileName))
+                continue;
+
+            auto it = scenes.find(sessionFileName);
+            if(it != scenes.end())
+            {
+                // This scene has been open before, delete and remove first
+                scenes.erase(it);
+            }
+
+            auto scene = std::make_unique<Scene>(QColor(32, 53, 53), doserateScripts);
+            scene->window->installEventFilter(this);
+            scene->session->setLazyChannels(ui->actionLazyChannels->isChecked());
+            applyMarkerStyle(*scene);
+
+            startLoading(sessionFileName, scene->session.get());
+
+            scenes[sessionFileName] = std::move(scene);
+        }
+    }
+    catch(const std::exception &e)
+    {
+        qDebug() << e.what();
+        labelStatus->setText(QStringLiteral("Opening sessions failed: ") + e.what());
+    }
+}
+
+void GammaViewer3D::onCancelLoading()
+{
+    try
+    {
+        for(auto &p : loaders)
+            p.first->cancel();
+    }
+    catch(const std::exception &e)
+    {
+        qDebug() << e.what();
+    }
+}
+
+void GammaViewer3D::startLoading(QString sessionFileName, Gamma::Session *session)
+{
+    labelStatus->setText("Loading session " + sessionFileName);
+    startLoader(new SessionLoader(session, sessionFileName), sessionFileName);
+}
+
+void GammaViewer3D::startApplyingScripts(QString sessionFileName, Gamma::Session *session)
+{
+    startLoader(new SessionLoader(session,
+                                  sessionFileName,
+                                  SessionLoader::ApplyDoserateScripts,
+                                  doserateScripts),
+                sessionFileName);
+}
+
+void GammaViewer3D::startAnalysis(QString sessionFileName, Gamma::Session *session,
+                                  QString scriptFileName)
+{
+    startLoader(new SessionLoader(session,
+                                  sessionFileName,
+                                  SessionLoader::RunAnalysisScript,
+                                  QStringList(scriptFileName)),
+                sessionFileName);
+}
+
+void GammaViewer3D::startLoader(SessionLoader *loader, QString sessionFileName)
+{
+    // Scenes are left alone by the GUI while their loader runs
+    auto thread = new QThread(this);
+    loader->moveToThread(thread);
+
+    QObject::connect(thread,
+                     &QThread::started,
+                     loader,
+                     &SessionLoader::run);
+
+    QObject::connect(thread,
+                     &QThread::finished,
+                     loader,
+                     &QObject::deleteLater);
+
+    QObject::connect(thread,
+                     &QThread::finished,
+                     thread,
+                     &QObject::deleteLater);
+
+    QObject::connect(loader,
+                     &SessionLoader::spectraLoaded,
+                     this,
+                     &GammaViewer3D::onSpectraLoaded);
+
+    QObject::connect(loader,
+                     &SessionLoader::doseratesCalculated,
+                     this,
+                     &GammaViewer3D::onDoseratesCalculated);
+
+    QObject::connect(loader,
+                     &SessionLoader::analysisFinished,
+                     this,
+                     &GammaViewer3D::onAnalysisFinished);
+
+    QObject::connect(loader,
+                     &SessionLoader::progress,
+                     this,
+                     &GammaViewer3D::onLoadProgress);
+
+    QObject::connect(loader,
+                     &SessionLoader::finished,
+                     this,
+                     &GammaViewer3D::onLoadFinished);
+
+    QObject::connect(loader,
+                     &SessionLoader::cancelled,
+                     this,
+                     &GammaViewer3D::onLoadCancelled);
+
+    QObject::connect(loader,
+                     &SessionLoader::failed,
+                     this,
+                     &GammaViewer3D::onLoadFailed);
+
+    loaders[loader] = sessionFileName;
+    loaderProgress[loader] = std::make_pair(0, 0);
+    updateLoadingState();
+
+    thread->start();
+}
+
+void GammaViewer3D::stopLoading(SessionLoader *loader)
+{
+    loaders.erase(loader);
+    loaderProgress.erase(loader);
+    loader->thread()->quit();
+    updateLoadingState();
+}
 
-        auto it = scenes.find(sessionFileName);
-        if(it != scenes.end())
+void GammaViewer3D::updateLoadingState()
+{
+    bool loading = !loaders.empty();
+
+    ui->actionCancelLoading->setEnabled(loading);
+
+    if(!loading)
+        progressLoading->reset();
+    progressLoading->setVisible(loading);
+    updateLoadingProgress();
+}
+
+void GammaViewer3D::updateLoadingProgress()
+{
+    // All running loads share one progress bar
+    int loaded = 0, total = 0;
+    for(auto &p : loaderProgress)
+    {
+        loaded += p.second.first;
+        total += p.second.second;
+    }
+
+    progressLoading->setMaximum(std::max(total, 1));
+    progressLoading->setValue(std::min(loaded, total));
+}
+
+Scene *GammaViewer3D::sceneFromLoader(QObject *loader) const
+{
+    // Only compare pointers, the loader may already be gone
+    auto it = loaders.find(static_cast<SessionLoader*>(loader));
+    if(it == loaders.end())
+        return nullptr;
+
+    auto sit = scenes.find(it->second);
+    if(sit == scenes.end())
+        return nullptr;
+
+    return sit->second.get();
+}
+
+bool GammaViewer3D::isLoading(const QString &sessionFileName) const
+{
+    return std::any_of(loaders.begin(), loaders.end(), [&](auto &p) {
+        return p.second == sessionFileName;
+    });
+}
+
+void GammaViewer3D::updateWatchedFiles()
+{
+    if(!sessionWatcher->files().isEmpty())
+        sessionWatcher->removePaths(sessionWatcher->files());
+    if(!sessionWatcher->directories().isEmpty())
+        sessionWatcher->removePaths(sessionWatcher->directories());
+
+    if(!ui->actionFollowSessions->isChecked())
+        return;
+
+    // Writers in WAL mode only touch the -wal file until a checkpoint, the
+    // directory is watched to see it being created
+    QStringList paths;
+    for(auto &p : scenes)
+    {
+        if(isLoading(p.first))
+            continue;
+
+        QString walFileName = p.first + "-wal";
+        paths << p.first << QFileInfo(p.first).absolutePath();
+        if(QFile::exists(walFileName))
+            paths << walFileName;
+    }
+
+    paths.removeDuplicates();
+    if(!paths.isEmpty())
+        sessionWatcher->addPaths(paths);
+}
+
+void GammaViewer3D::setupScene(Scene &scene)
+{
+    const Gamma::Session &session = *scene.session;
+
+    scene.setOrigin(session.minX() + session.halfX(),
+                    session.minY() + session.halfY(),
+                    session.minAltitude());
+
+    new GridEntityXZ(-1.0f, 10, 10.0f, QColor(255, 255, 255), scene.root);
+
+    new CompassEntity(QColor(255, 0, 0),
+                      scene.makeScenePosition(session.centerPosition, session.minAltitude() - 5.0),
+                      scene.makeScenePosition(session.northPosition, session.minAltitude() - 5.0),
+                      scene.root);
+
+    scene.camera->setUpVector(QVector3D(0.0, 1.0, 0.0));
+    scene.camera->setPosition(QVector3D(0, 20, 100.0f));
+    scene.camera->setViewCenter(QVector3D(0, 0, 0));
+
+    scene.window->setTitle(session.name());
+    scene.window->show();
+}
+
+void GammaViewer3D::applyMarkerStyle(Scene &scene)
+{
+    // Spheres look better up close in small sessions, sprites scale to
+    // large ones
+    if(ui->actionSphereMarkers->isChecked())
+        scene.markers->setStyle(MarkerMaterial::Spheres);
+    else
+        scene.markers->setStyle(MarkerMaterial::Sprites);
+
+    scene.markers->setScreenRadius(ui->actionScreenSizedMarkers->isChecked()
+                                   ? SpectrumMarkerEntity::DefaultScreenRadius
+                                   : 0.0f);
+}
+
+void GammaViewer3D::recolorScene(Scene &scene)
+{
+    const Gamma::Session &session = *scene.session;
+
+    std::vector<Gamma::ColorRGBA8> colors;
+    session.makeDoserateColors(colors);
+    scene.markers->setColors(colors);
+}
+
+void GammaViewer3D::selectDoseModel(Scene &scene)
+{
+    // Sessions may hold different models, they are matched by name and
+    // sessions without the selected model keep their own
+    int index = scene.session->doseModelNames().indexOf(comboDoseModel->currentText());
+    if(index < 0)
+        return;
+
+    scene.session->setActiveDoseModel((std::size_t)index);
+}
+
+void GammaViewer3D::updateDoseModels()
+{
+    // The combo lists the models of every loaded session once
+    QStringList names;
+    for(auto &p : scenes)
+    {
+        if(isLoading(p.first) || !p.second->hasOrigin)
+            continue;
+
+        for(auto &name : p.second->session->doseModelNames())
         {
-            // This scene has been open before, delete and remove first
-            scenes.erase(it);
+            if(!names.contains(name))
+                names << name;
         }
+    }
+
+    QSignalBlocker blocker(comboDoseModel);
+    QString current = comboDoseModel->currentText();
+    comboDoseModel->clear();
+    comboDoseModel->addItems(names);
+    comboDoseModel->setCurrentIndex(std::max(names.indexOf(current), 0));
+    comboDoseModel->setEnabled(names.size() > 1);
+}
+
+void GammaViewer3D::addSpectrumMarkers(Scene &scene, Gamma::SpectrumStoreSize first)
+{
+    const Gamma::Session &session = *scene.session;
+
+    std::vector<QVector3D> positions;
+    for(auto i = first; i < session.spectrumCount(); i++)
+        positions.push_back(makeScenePosition(scene, session.spectrum(i)));
+
+    std::vector<Gamma::ColorRGBA8> colors;
+    session.makeDoserateColors(colors, first);
+
+    scene.appendPositions(positions);
+    scene.markers->appendMarkers(positions, colors);
+}
+
+void GammaViewer3D::onSpectraLoaded(Gamma::SpectrumChunk chunk)
+{
+    try
+    {
+        Scene *scene = sceneFromLoader(sender());
+        if(!scene || !chunk)
+            return;
+
+        Gamma::Session &session = *scene->session;
+        auto first = session.spectrumCount();
+
+        session.appendSpectra(std::move(*chunk));
 
-        auto scene = std::make_unique<Scene>(QColor(32, 53, 53), sessionFileName, doserateScript);
+        if(!scene->hasOrigin)
+            setupScene(*scene);
 
-        const Gamma::Session &session = *scene->session;
+        addSpectrumMarkers(*scene, first);
+    }
+    catch(const std::exception &e)
+    {
+        qDebug() << e.what();
+    }
+}
 
-        new GridEntityXZ(-1.0f, 10, 10.0f, QColor(255, 255, 255), scene->root);
+void GammaViewer3D::onLoadProgress(int loaded, int total)
+{
+    auto it = loaderProgress.find(static_cast<SessionLoader*>(sender()));
+    if(it == loaderProgress.end())
+        return;
 
-        new CompassEntity(QColor(255, 0, 0),
-                          makeScenePosition(session, session.centerPosition, session.minAltitude() - 5.0),
-                          makeScenePosition(session, session.northPosition, session.minAltitude() - 5.0),
-                          scene->root);
+    it->second = std::make_pair(loaded, total);
+    updateLoadingProgress();
+}
 
-        for(const auto &spec : session.spectrumList())
+void GammaViewer3D::onLoadFinished()
+{
+    try
+    {
+        auto it = loaders.find(static_cast<SessionLoader*>(sender()));
+        if(it == loaders.end())
+            return;
+
+        Scene *scene = sceneFromLoader(it->first);
+        if(scene)
         {
-            const Gamma::Spectrum &spectrum = *spec;
+            if(!scene->hasOrigin)
+                setupScene(*scene);
 
-            auto entity = new SpectrumEntity(makeScenePosition(session, spectrum),
-                                             session.makeDoserateColor(spectrum),
-                                             spectrum,
-                                             scene->root);
+            auto statistics = scene->session->loadStatistics().toString();
+            labelStatus->setText("Session " + it->second + " loaded: " + statistics);
+        }
+        else
+            labelStatus->setText("Session " + it->second + " loaded");
+        stopLoading(it->first);
+        updateWatchedFiles();
 
-            QObject::connect(entity->picker(),
-                             &Qt3DRender::QObjectPicker::pressed,
-                             this,
-                             &GammaViewer3D::onSpectrumPicked);
+        if(scene)
+        {
+            // Colors assigned while loading used a partial doserate range
+            updateDoseModels();
+            selectDoseModel(*scene);
+            recolorScene(*scene);
         }
+    }
+    catch(const std::exception &e)
+    {
+        qDebug() << e.what();
+    }
+}
 
-        scene->camera->setUpVector(QVector3D(0.0, 1.0, 0.0));
-        scene->camera->setPosition(QVector3D(0, 20, 100.0f));
-        scene->camera->setViewCenter(QVector3D(0, 0, 0));
+static QString describeJob(const SessionLoader &loader, const QString &sessionFileName)
+{
+    switch(loader.job())
+    {
+    case SessionLoader::ApplyDoserateScripts:
+        return "Applying doserate scripts to session " + sessionFileName;
+    case SessionLoader::RunAnalysisScript:
+        return "Analysis of session " + sessionFileName;
+    default:
+        return "Loading of session " + sessionFileName;
+    }
+}
 
-        scene->window->show();
+void GammaViewer3D::onLoadCancelled()
+{
+    try
+    {
+        auto it = loaders.find(static_cast<SessionLoader*>(sender()));
+        if(it == loaders.end())
+            return;
 
-        scenes[sessionFileName] = std::move(scene);
-        labelStatus->setText("Session " + sessionFileName + " loaded");
+        // Jobs on a loaded session leave it as it was
+        labelStatus->setText(describeJob(*it->first, it->second) + " cancelled");
+        if(it->first->job() == SessionLoader::LoadSession)
+            scenes.erase(it->second);
+        stopLoading(it->first);
+        updateWatchedFiles();
+    }
+    catch(const std::exception &e)
+    {
+        qDebug() << e.what();
+    }
+}
+
+void GammaViewer3D::onLoadFailed(QString message)
+{
+    try
+    {
+        auto it = loaders.find(static_cast<SessionLoader*>(sender()));
+        if(it == loaders.end())
+            return;
+
+        qDebug() << message;
+        labelStatus->setText(describeJob(*it->first, it->second) + " failed: " + message);
+        if(it->first->job() == SessionLoader::LoadSession)
+            scenes.erase(it->second);
+        stopLoading(it->first);
+        updateWatchedFiles();
     }
     catch(const std::exception &e)
     {
@@ -179,16 +645,98 @@ void GammaViewer3D::onLoadDoserateScript()
 {
     try
     {
-        QString scriptFileName = QFileDialog::getOpenFileName(
+        QStringList scriptFileNames = QFileDialog::getOpenFileNames(
                     this,
-                    tr("Load doserate script"),
+                    tr("Load doserate scripts"),
                     QDir::homePath(),
                     tr("Lua script (*.lua)"));
 
-        doserateScript = QDir::toNativeSeparators(scriptFileName);
+        if(scriptFileNames.isEmpty())
+            return;
+
+        doserateScripts.clear();
+        for(auto &scriptFileName : scriptFileNames)
+            doserateScripts << QDir::toNativeSeparators(scriptFileName);
 
         ui->lblDoserateScript->setText(
-                    QStringLiteral("Loaded doserate script: ") + doserateScript);
+                    QStringLiteral("Loaded doserate scripts: ") + doserateScripts.join(", "));
+        ui->actionApplyDoserateScript->setEnabled(true);
+    }
+    catch(const std::exception &e)
+    {
+        qDebug() << e.what();
+    }
+}
+
+void GammaViewer3D::onApplyDoserateScript()
+{
+    try
+    {
+        if(doserateScripts.isEmpty())
+            return;
+
+        // Sessions still loading use their script on the loader thread, the
+        // others are recalculated on one and keep their doserates until done
+        int count = 0;
+        for(auto &p : scenes)
+        {
+            if(isLoading(p.first) || !p.second->hasOrigin)
+                continue;
+
+            startApplyingScripts(p.first, p.second->session.get());
+            count++;
+        }
+
+        labelStatus->setText("Applying " + doserateScripts.join(", ") + " to " +
+                             QString::number(count) + " sessions");
+    }
+    catch(const std::exception &e)
+    {
+        qDebug() << e.what();
+    }
+}
+
+void GammaViewer3D::onDoseratesCalculated(Gamma::DoserateUpdatePointer update)
+{
+    try
+    {
+        auto it = loaders.find(static_cast<SessionLoader*>(sender()));
+        if(it == loaders.end() || !update)
+            return;
+
+        Scene *scene = sceneFromLoader(it->first);
+        QString sessionFileName = it->second;
+        stopLoading(it->first);
+
+        if(!scene)
+            return;
+
+        scene->session->commitDoserateUpdate(*update);
+        updateDoseModels();
+        selectDoseModel(*scene);
+        recolorScene(*scene);
+
+        labelStatus->setText("Applied " + doserateScripts.join(", ") + " to session " + sessionFileName);
+    }
+    catch(const std::exception &e)
+    {
+        qDebug() << e.what();
+    }
+}
+
+void GammaViewer3D::onDoseModelChanged(int)
+{
+    try
+    {
+        // Doserates of every model are in memory, no session is read again
+        for(auto &p : scenes)
+        {
+            if(isLoading(p.first) || !p.second->hasOrigin)
+                continue;
+
+            selectDoseModel(*p.second);
+            recolorScene(*p.second);
+        }
     }
     catch(const std::exception &e)
     {
@@ -196,43 +744,158 @@ void GammaViewer3D::onLoadDoserateScript()
     }
 }
 
-void GammaViewer3D::onSpectrumPicked(Qt3DRender::QPickEvent *event)
+void GammaViewer3D::onRunAnalysisScript()
 {
     try
     {
-        // Store the selected spectrum entity
-        auto entity = qobject_cast<SpectrumEntity*>(sender()->parent());
-        if(!entity)
+        QString scriptFileName = QFileDialog::getOpenFileName(
+                    this,
+                    tr("Run analysis script"),
+                    QDir::homePath(),
+                    tr("Lua script (*.lua)"));
+
+        if(scriptFileName.isEmpty())
+            return;
+
+        scriptFileName = QDir::toNativeSeparators(scriptFileName);
+
+        // The script gets the spectra of each session, not of all at once,
+        // and runs on a loader thread so it can be cancelled
+        int count = 0;
+        for(auto &p : scenes)
         {
-            qDebug() << "GammaAnalyzer3D::onSpectrumPicked: casting to SpectrumEntity failed";
+            if(isLoading(p.first) || !p.second->hasOrigin)
+                continue;
+
+            startAnalysis(p.first, p.second->session.get(), scriptFileName);
+            count++;
+        }
+
+        labelStatus->setText("Running " + QFileInfo(scriptFileName).completeBaseName() +
+                             " on " + QString::number(count) + " sessions");
+    }
+    catch(const std::exception &e)
+    {
+        qDebug() << e.what();
+        labelStatus->setText(e.what());
+    }
+}
+
+void GammaViewer3D::onAnalysisFinished(QString columnName, Gamma::AnalysisColumn column)
+{
+    try
+    {
+        auto it = loaders.find(static_cast<SessionLoader*>(sender()));
+        if(it == loaders.end() || !column)
+            return;
+
+        Scene *scene = sceneFromLoader(it->first);
+        QString sessionFileName = it->second;
+        stopLoading(it->first);
+
+        if(!scene)
             return;
+
+        scene->session->setColorColumn(columnName, std::move(*column));
+        recolorScene(*scene);
+
+        labelStatus->setText("Colored session " + sessionFileName + " by " + columnName);
+    }
+    catch(const std::exception &e)
+    {
+        qDebug() << e.what();
+        labelStatus->setText(e.what());
+    }
+}
+
+void GammaViewer3D::onColorByDoserate()
+{
+    try
+    {
+        for(auto &p : scenes)
+        {
+            if(isLoading(p.first) || !p.second->hasOrigin)
+                continue;
+
+            p.second->session->clearColorColumn();
+            recolorScene(*p.second);
+        }
+    }
+    catch(const std::exception &e)
+    {
+        qDebug() << e.what();
+    }
+}
+
+bool GammaViewer3D::eventFilter(QObject *watched, QEvent *event)
+{
+    if(event->type() != QEvent::MouseButtonPress && event->type() != QEvent::MouseMove)
+        return QMainWindow::eventFilter(watched, event);
+
+    try
+    {
+        Scene *scene = sceneFromWindow(watched);
+        if(!scene)
+            return false;
+
+        auto mouseEvent = static_cast<QMouseEvent*>(event);
+
+        if(event->type() == QEvent::MouseMove)
+        {
+            // Skip hover while dragging the camera
+            if(mouseEvent->buttons() == Qt::NoButton)
+                handleHoverSpectrum(*scene, mouseEvent->pos(), mouseEvent->globalPos());
+            return false;
         }
 
+        Gamma::SpectrumStoreSize index;
+        if(!scene->pickSpectrum(mouseEvent->pos(), index))
+            return false;
+
         // Handle event based on mouse button
-        if(event->button() == Qt3DRender::QPickEvent::LeftButton)
-            handleSelectSpectrum(entity);
-        else if(event->button() == Qt3DRender::QPickEvent::RightButton)
-            handleMarkSpectrum(entity);
+        if(mouseEvent->button() == Qt::LeftButton)
+            handleSelectSpectrum(*scene, index);
+        else if(mouseEvent->button() == Qt::RightButton)
+            handleMarkSpectrum(*scene, index);
     }
     catch(const std::exception &e)
     {
         qDebug() << e.what();
     }
+
+    // The camera controller still gets the press
+    return false;
 }
 
-const Scene &GammaViewer3D::sceneFromEntity(SpectrumEntity *entity) const
+void GammaViewer3D::handleHoverSpectrum(Scene &scene, const QPoint &point, const QPoint &globalPoint)
+{
+    Gamma::SpectrumStoreSize index;
+    if(!scene.pickSpectrum(point, index))
+    {
+        QToolTip::hideText();
+        return;
+    }
+
+    Gamma::Spectrum spec = scene.session->spectrum(index);
+    QToolTip::showText(
+                globalPoint,
+                spec.sessionName() + " / " +
+                QString::number(spec.sessionIndex()) +
+                QStringLiteral("\nDoserate: ") +
+                QString::number(spec.doserate(), 'E') +
+                QStringLiteral(" μSv"));
+}
+
+Scene *GammaViewer3D::sceneFromWindow(QObject *window) const
 {
     auto it = std::find_if(scenes.begin(), scenes.end(), [&](auto &p){
-        return p.second->hasChildEntity(entity);
+        return p.second->window == window;
     });
 
-    if(it == scenes.end())
-        throw Exception_NoSceneFoundForEntity("GammaAnalyzer3D::sceneFromEntity");
-
-    return *it->second;
+    return it != scenes.end() ? it->second.get() : nullptr;
 }
 
-void GammaViewer3D::handleSelectSpectrum(SpectrumEntity *entity)
+void GammaViewer3D::handleSelectSpectrum(Scene &scene, Gamma::SpectrumStoreSize index)
 {
     // Disable selected and marked arrows for all scenes
     for(auto &p : scenes)
@@ -241,14 +904,12 @@ void GammaViewer3D::handleSelectSpectrum(SpectrumEntity *entity)
         p.second->marked->setEnabled(false);
     }
 
-    auto &scene = sceneFromEntity(entity);
-
     // Enable current selection arrow
-    scene.selected->setTarget(entity);
+    scene.selected->setTarget(index, scene.positions[index]);
     scene.selected->setEnabled(true);
 
     // Populate UI fields with information about selected spectrum
-    auto &spec = entity->spectrum();
+    Gamma::Spectrum spec = scene.session->spectrum(index);
 
     ui->lblSessionSpectrum->setText(
                 QStringLiteral("Session / Spectrum: ") +
@@ -256,7 +917,7 @@ void GammaViewer3D::handleSelectSpectrum(SpectrumEntity *entity)
                 QString::number(spec.sessionIndex()));
     ui->lblCoordinates->setText(
                 QStringLiteral("Coordinates: ") +
-                spec.coordinate.toString(QGeoCoordinate::Degrees));
+                spec.coordinate().toString(QGeoCoordinate::Degrees));
     ui->lblLivetimeRealtime->setText(
                 QStringLiteral("Livetime / Realtime: ") +
                 QString::number(spec.livetime() / 1000000.0) +
@@ -267,6 +928,14 @@ void GammaViewer3D::handleSelectSpectrum(SpectrumEntity *entity)
                 QStringLiteral("Doserate: ") +
                 QString::number(spec.doserate(), 'E') +
                 QStringLiteral(" μSv"));
+
+    // Channels may have to be read from the database
+    auto channels = scene.session->spectrumChannels(spec.index());
+    ui->lblCounts->setText(
+                QStringLiteral("Counts / Channels: ") +
+                QString::number(std::accumulate(channels.begin(), channels.end(), 0LL)) +
+                QStringLiteral(" / ") +
+                QString::number(channels.size()));
     ui->lblDate->setText(
                 QStringLiteral("Date: ") +
                 spec.gpsTimeStart().toLocalTime().
@@ -274,24 +943,22 @@ void GammaViewer3D::handleSelectSpectrum(SpectrumEntity *entity)
     ui->lblDistance->setText("");
 }
 
-void GammaViewer3D::handleMarkSpectrum(SpectrumEntity *entity)
+void GammaViewer3D::handleMarkSpectrum(Scene &scene, Gamma::SpectrumStoreSize index)
 {
-    auto &scene = sceneFromEntity(entity);
-
-    if(!scene.selected->isEnabled() || !scene.selected->target() ||
-            scene.selected->target() == entity)
+    if(!scene.selected->isEnabled() || !scene.selected->hasTarget() ||
+            scene.selected->target() == index)
         return;
 
     // Enable current marked arrow
-    scene.marked->setTarget(entity);
+    scene.marked->setTarget(index, scene.positions[index]);
     scene.marked->setEnabled(true);
 
     // Calculate distance and azimuth
-    auto &spec1 = scene.selected->target()->spectrum();
-    auto &spec2 = entity->spectrum();
+    Gamma::Spectrum spec1 = scene.session->spectrum(scene.selected->target());
+    Gamma::Spectrum spec2 = scene.session->spectrum(index);
 
-    auto distance = spec1.coordinate.distanceTo(spec2.coordinate);
-    auto azimuth = spec1.coordinate.azimuthTo(spec2.coordinate);
+    auto distance = spec1.coordinate().distanceTo(spec2.coordinate());
+    auto azimuth = spec1.coordinate().azimuthTo(spec2.coordinate());
 
     ui->lblDistance->setText(
                 QStringLiteral("Distance / Azimuth from ") +
@@ -304,3 +971,87 @@ void GammaViewer3D::handleMarkSpectrum(SpectrumEntity *entity)
                 QString::number(azimuth, 'f', 1) +
                 QStringLiteral("°"));
 }
+
+void GammaViewer3D::onFollowSessions(bool checked)
+{
+    try
+    {
+        updateWatchedFiles();
+
+        // Pick up anything written while follow mode was off
+        if(checked)
+            followTimer->start();
+    }
+    catch(const std::exception &e)
+    {
+        qDebug() << e.what();
+    }
+}
+
+void GammaViewer3D::onMarkerStyleChanged()
+{
+    try
+    {
+        // Screen size only applies to sprites
+        ui->actionScreenSizedMarkers->setEnabled(!ui->actionSphereMarkers->isChecked());
+
+        for(auto &p : scenes)
+            applyMarkerStyle(*p.second);
+    }
+    catch(const std::exception &e)
+    {
+        qDebug() << e.what();
+    }
+}
+
+void GammaViewer3D::onSessionFileChanged()
+{
+    followTimer->start();
+}
+
+void GammaViewer3D::onFollowTimeout()
+{
+    try
+    {
+        if(!ui->actionFollowSessions->isChecked())
+            return;
+
+        for(auto &p : scenes)
+        {
+            Scene &scene = *p.second;
+            if(isLoading(p.first) || !scene.hasOrigin)
+                continue;
+
+            Gamma::Session &session = *scene.session;
+            auto first = session.spectrumCount();
+            auto minDoserate = session.minDoserate();
+            auto maxDoserate = session.maxDoserate();
+            QString colorColumnName = session.colorColumnName();
+
+            auto count = session.readNewSpectra();
+            if(!count)
+                continue;
+
+            addSpectrumMarkers(scene, first);
+
+            bool hadColorColumn = !colorColumnName.isEmpty();
+            if(hadColorColumn || session.minDoserate() != minDoserate
+                    || session.maxDoserate() != maxDoserate)
+                recolorScene(scene);
+
+            // The analysis column does not cover the new spectra and is gone
+            QString message = QString::number(count) + " new spectra in session " + p.first;
+            if(hadColorColumn)
+                message += ", colored by doserate again instead of " + colorColumnName
+                        + ", run the analysis script again to update it";
+            labelStatus->setText(message);
+        }
+
+        // Files replaced by the writer drop out of the watcher
+        updateWatchedFiles();
+    }
+    catch(const std::exception &e)
+    {
+        qDebug() << e.what();
+    }
+}
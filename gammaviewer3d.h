@@ -18,13 +18,21 @@
 #define GAMMAVIEWER3D_H
 
 #include "exceptions.h"
+#include "sessionloader.h"
 #include <map>
 #include <memory>
+#include <utility>
 #include <QMainWindow>
 #include <QString>
+#include <QPoint>
+#include <QStringList>
 #include <QCloseEvent>
+#include <QEvent>
 #include <QLabel>
-#include <Qt3DRender/QPickEvent>
+#include <QComboBox>
+#include <QProgressBar>
+#include <QFileSystemWatcher>
+#include <QTimer>
 
 namespace Ui
 {
@@ -32,7 +40,6 @@ class GammaViewer3D;
 }
 
 class Scene;
-class SpectrumEntity;
 
 class GammaViewer3D : public QMainWindow
 {
@@ -47,33 +54,70 @@ protected:
 
     void closeEvent(QCloseEvent *event) override;
 
+    // Mouse presses in the scene windows pick spectra
+    bool eventFilter(QObject *watched, QEvent *event) override;
+
 private:
 
     Ui::GammaViewer3D *ui;
     QLabel *labelStatus;
+    QProgressBar *progressLoading;
+    QFileSystemWatcher *sessionWatcher;
+    QTimer *followTimer;
+    QComboBox *comboDoseModel;
     std::map<QString, std::unique_ptr<Scene>> scenes;
-    QString doserateScript;
+    std::map<SessionLoader*, QString> loaders;
+    std::map<SessionLoader*, std::pair<int, int>> loaderProgress;
+    QStringList doserateScripts;
 
     void setupWidgets();
     void setupSignals();
 
-    const Scene &sceneFromEntity(SpectrumEntity *entity) const;
-
-    void handleSelectSpectrum(SpectrumEntity *entity);
-    void handleMarkSpectrum(SpectrumEntity *entity);
-
-    struct Exception_NoSceneFoundForEntity : public Exception
-    {
-        explicit Exception_NoSceneFoundForEntity(QString source) noexcept
-            : Exception("No scene found for entity: " + source) {}
-    };
+    void startLoading(QString sessionFileName, Gamma::Session *session);
+    void startApplyingScripts(QString sessionFileName, Gamma::Session *session);
+    void startAnalysis(QString sessionFileName, Gamma::Session *session, QString scriptFileName);
+    void startLoader(SessionLoader *loader, QString sessionFileName);
+    void stopLoading(SessionLoader *loader);
+    void updateLoadingState();
+    void updateLoadingProgress();
+    Scene *sceneFromLoader(QObject *loader) const;
+    bool isLoading(const QString &sessionFileName) const;
+    void updateWatchedFiles();
+
+    void setupScene(Scene &scene);
+    void recolorScene(Scene &scene);
+    void selectDoseModel(Scene &scene);
+    void updateDoseModels();
+    void addSpectrumMarkers(Scene &scene, Gamma::SpectrumStoreSize first);
+    void applyMarkerStyle(Scene &scene);
+
+    Scene *sceneFromWindow(QObject *window) const;
+
+    void handleSelectSpectrum(Scene &scene, Gamma::SpectrumStoreSize index);
+    void handleMarkSpectrum(Scene &scene, Gamma::SpectrumStoreSize index);
+    void handleHoverSpectrum(Scene &scene, const QPoint &point, const QPoint &globalPoint);
 
 private slots:
 
     void onActionExit();
     void onOpenSession();
+    void onCancelLoading();
     void onLoadDoserateScript();
-    void onSpectrumPicked(Qt3DRender::QPickEvent *event);
+    void onApplyDoserateScript();
+    void onDoseModelChanged(int index);
+    void onRunAnalysisScript();
+    void onColorByDoserate();
+    void onSpectraLoaded(Gamma::SpectrumChunk chunk);
+    void onDoseratesCalculated(Gamma::DoserateUpdatePointer update);
+    void onAnalysisFinished(QString columnName, Gamma::AnalysisColumn column);
+    void onLoadProgress(int loaded, int total);
+    void onLoadFinished();
+    void onLoadCancelled();
+    void onLoadFailed(QString message);
+    void onFollowSessions(bool checked);
+    void onMarkerStyleChanged();
+    void onSessionFileChanged();
+    void onFollowTimeout();
 };
 
 #endif // GAMMAVIEWER3D_H
@@ -0,0 +1,155 @@
+//  gamma-viewer-3d - 3d visualization of sessions generated by gamma-analyzer
+//  Copyright (C) 2017  Dag Robole
+//
+//  This program is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "geweighttable.h"
+#include <map>
+#include <mutex>
+
+namespace Gamma
+{
+
+GEWeightTable::GEWeightTable(const Detector &detector, lua_State *L)
+{
+    if(!L)
+        throw Exception_InvalidPointer("GEWeightTable::GEWeightTable: L");
+
+    channelWindow(detector, mStartChannel, mEndChannel);
+
+    mWeights.assign(mEndChannel, 0.0);
+
+    const EnergyList &energies = detector.energyTable();
+
+    LuaBudget budget(L);
+
+    if(hasGEValueBatch(L))
+    {
+        // One call for the whole window, invalid energies are zeroed after
+        std::vector<double> window(energies.begin() + mStartChannel,
+                                   energies.begin() + mEndChannel);
+        for(auto &E : window)
+            E /= 1000.0;
+
+        luaGEValueBatch(L, window.data(), mWeights.data() + mStartChannel, window.size());
+
+        clearInvalidWeights(energies);
+        return;
+    }
+
+    for(int i = mStartChannel; i < mEndChannel; i++)
+    {
+        double E = energies[i];
+        if (E < 0.05) // Energies below 0.05 are invalid
+            continue;
+        mWeights[i] = luaGEValue(L, E / 1000.0);
+    }
+}
+
+GEWeightTable::GEWeightTable(const Detector &detector, const DoseratePlugin &plugin)
+{
+    channelWindow(detector, mStartChannel, mEndChannel);
+
+    mWeights.assign(mEndChannel, 0.0);
+
+    const EnergyList &energies = detector.energyTable();
+
+    std::vector<double> window(energies.begin() + mStartChannel,
+                               energies.begin() + mEndChannel);
+    for(auto &E : window)
+        E /= 1000.0;
+
+    plugin.GEValues(window.data(), mWeights.data() + mStartChannel, window.size());
+
+    clearInvalidWeights(energies);
+}
+
+void GEWeightTable::clearInvalidWeights(const EnergyList &energies)
+{
+    for(int i = mStartChannel; i < mEndChannel; i++)
+    {
+        if (energies[i] < 0.05) // Energies below 0.05 are invalid
+            mWeights[i] = 0.0;
+    }
+}
+
+void GEWeightTable::channelWindow(const Detector &detector, int &startChannel, int &endChannel)
+{
+    // Trim off discriminators
+    startChannel = (int)((double)detector.numChannels() *
+                         ((double)detector.LLD() / 100.0));
+    endChannel = (int)((double)detector.numChannels() *
+                       ((double)detector.ULD() / 100.0));
+    if(endChannel > detector.numChannels()) // FIXME: Can not exceed 100% atm
+        endChannel = detector.numChannels();
+    if(startChannel < 0)
+        startChannel = 0;
+    if(endChannel < startChannel)
+        endChannel = startChannel;
+}
+
+static QString makeDetectorKey(const Detector &detector)
+{
+    QString key = detector.typeName() + '|' +
+            detector.serialnumber() + '|' +
+            QString::number(detector.numChannels()) + '|' +
+            QString::number(detector.LLD()) + '|' +
+            QString::number(detector.ULD());
+
+    for(auto c : detector.energyCurveCoefficients())
+        key += '|' + QString::number(c, 'g', 17);
+
+    return key;
+}
+
+template<typename Source>
+static GEWeightTablePointer lookupTable(const Detector &detector,
+                                       QString scriptKey,
+                                       const Source &source)
+{
+    static std::mutex cacheMutex;
+    static std::map<QString, GEWeightTablePointer> cache;
+
+    QString key = makeDetectorKey(detector) + '|' + scriptKey;
+
+    {
+        std::lock_guard<std::mutex> lock(cacheMutex);
+        auto it = cache.find(key);
+        if(it != cache.end())
+            return it->second;
+    }
+
+    // Scripts run outside the lock so other sessions are not held up, a
+    // table made meanwhile for the same key wins
+    auto table = std::make_shared<const GEWeightTable>(detector, source);
+
+    std::lock_guard<std::mutex> lock(cacheMutex);
+    return cache.emplace(key, table).first->second;
+}
+
+GEWeightTablePointer GEWeightTable::lookup(const Detector &detector,
+                                           QString scriptKey,
+                                           lua_State *L)
+{
+    return lookupTable(detector, scriptKey, L);
+}
+
+GEWeightTablePointer GEWeightTable::lookup(const Detector &detector,
+                                           QString scriptKey,
+                                           const DoseratePlugin &plugin)
+{
+    return lookupTable(detector, scriptKey, plugin);
+}
+
+} // namespace Gamma
@@ -0,0 +1,76 @@
+//  gamma-viewer-3d - 3d visualization of sessions generated by gamma-analyzer
+//  Copyright (C) 2017  Dag Robole
+//
+//  This program is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef GEWEIGHTTABLE_H
+#define GEWEIGHTTABLE_H
+
+#include "exceptions.h"
+#include "detector.h"
+#include "luastate.h"
+#include "doserateplugin.h"
+#include <memory>
+#include <vector>
+#include <QString>
+
+namespace Gamma
+{
+
+class GEWeightTable;
+
+typedef std::shared_ptr<const GEWeightTable> GEWeightTablePointer;
+typedef std::vector<double> WeightList;
+
+class GEWeightTable
+{
+public:
+
+    GEWeightTable(const Detector &detector, lua_State *L);
+    GEWeightTable(const Detector &detector, const DoseratePlugin &plugin);
+    GEWeightTable(const GEWeightTable &rhs) = delete;
+    ~GEWeightTable() = default;
+
+    GEWeightTable &operator = (const GEWeightTable &) = delete;
+
+    // Channels inside the LLD..ULD window
+    int startChannel() const { return mStartChannel; }
+    int endChannel() const { return mEndChannel; }
+
+    // GE value per channel, zero for channels with invalid energies
+    const WeightList &weights() const { return mWeights; }
+
+    // Channel window of a detector, after trimming off the discriminators
+    static void channelWindow(const Detector &detector, int &startChannel, int &endChannel);
+
+    static GEWeightTablePointer lookup(const Detector &detector,
+                                       QString scriptKey,
+                                       lua_State *L);
+
+    static GEWeightTablePointer lookup(const Detector &detector,
+                                       QString scriptKey,
+                                       const DoseratePlugin &plugin);
+
+private:
+
+    int mStartChannel;
+    int mEndChannel;
+    WeightList mWeights;
+
+    void clearInvalidWeights(const EnergyList &energies);
+};
+
+} // namespace Gamma
+
+#endif // GEWEIGHTTABLE_H
@@ -0,0 +1,46 @@
+//  gamma-viewer-3d - 3d visualization of sessions generated by gamma-analyzer
+//  Copyright (C) 2017  Dag Robole
+//
+//  This program is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "loadstatistics.h"
+
+namespace Gamma
+{
+
+static QString formatTime(qint64 nsecs)
+{
+    return QString::number(nsecs / 1.0e6, 'f', 1) + " ms";
+}
+
+QString LoadStatistics::toString() const
+{
+    QString text = QString("%1 spectra from %2 in %3 (read %4, doserates %5, cache %6)")
+            .arg(spectrumCount)
+            .arg(source)
+            .arg(formatTime(totalTime))
+            .arg(formatTime(readTime))
+            .arg(formatTime(doserateTime))
+            .arg(formatTime(cacheTime));
+
+    if(luaAllocations > 0 || luaScriptTime > 0)
+        text += QString(", Lua %1 in scripts, %2 allocations, peak %3 KiB")
+                .arg(formatTime(luaScriptTime))
+                .arg(luaAllocations)
+                .arg(luaPeakBytes / 1024);
+
+    return text;
+}
+
+} // namespace Gamma
@@ -0,0 +1,59 @@
+//  gamma-viewer-3d - 3d visualization of sessions generated by gamma-analyzer
+//  Copyright (C) 2017  Dag Robole
+//
+//  This program is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef LOADSTATISTICS_H
+#define LOADSTATISTICS_H
+
+#include <QtGlobal>
+#include <QString>
+
+namespace Gamma
+{
+
+// Timings of the last session load, all times are in nanoseconds
+struct LoadStatistics
+{
+    LoadStatistics()
+        :
+          spectrumCount(0),
+          readTime(0),
+          doserateTime(0),
+          cacheTime(0),
+          totalTime(0),
+          luaAllocations(0),
+          luaPeakBytes(0),
+          luaScriptTime(0) {}
+
+    QString source;
+    int spectrumCount;
+    qint64 readTime;
+    qint64 doserateTime;
+    qint64 cacheTime;
+    qint64 totalTime;
+
+    // Allocations made by doserate scripts, summed over their Lua states
+    qint64 luaAllocations;
+    qint64 luaPeakBytes;
+
+    // Time spent in doserate script calls, over all threads
+    qint64 luaScriptTime;
+
+    QString toString() const;
+};
+
+} // namespace Gamma
+
+#endif // LOADSTATISTICS_H
@@ -0,0 +1,196 @@
+//  gamma-viewer-3d - 3d visualization of sessions generated by gamma-analyzer
+//  Copyright (C) 2017  Dag Robole
+//
+//  This program is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "luaarena.h"
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+
+namespace Gamma
+{
+
+LuaArena::LuaArena()
+    :
+      mCursor(nullptr),
+      mEnd(nullptr),
+      mByteLimit(0)
+{
+    std::fill(mFreeLists, mFreeLists + NumClasses, nullptr);
+}
+
+LuaArena::~LuaArena()
+{
+    for(auto page : mPages)
+        std::free(page);
+}
+
+void *LuaArena::allocate(void *ud, void *ptr, std::size_t osize, std::size_t nsize)
+{
+    return static_cast<LuaArena*>(ud)->reallocate(ptr, osize, nsize);
+}
+
+void LuaArena::resetStatistics()
+{
+    mStatistics.allocations = 0;
+    mStatistics.frees = 0;
+    mStatistics.peakBytes = mStatistics.bytes;
+}
+
+void *LuaArena::reallocate(void *ptr, std::size_t osize, std::size_t nsize)
+{
+    // For new blocks Lua passes the object type in osize
+    if(!ptr)
+        osize = 0;
+
+    if(nsize == 0)
+    {
+        if(ptr)
+        {
+            freeBlock(ptr, osize);
+            mStatistics.frees++;
+            mStatistics.bytes -= osize;
+        }
+        return nullptr;
+    }
+
+    if(mByteLimit && nsize > osize && mStatistics.bytes + (nsize - osize) > mByteLimit)
+        return nullptr;
+
+    void *block = nullptr;
+
+    // Lua expects shrinking to always succeed, when no smaller block can
+    // be had the old one is kept
+    bool shrinking = ptr && nsize <= osize;
+
+    if(ptr && osize > MaxSmallSize && nsize > MaxSmallSize)
+    {
+        block = std::realloc(ptr, nsize);
+        if(!block)
+        {
+            if(!shrinking)
+                return nullptr;
+            block = ptr;
+        }
+    }
+    else if(ptr && osize <= MaxSmallSize && nsize <= MaxSmallSize
+            && sizeClass(osize) == sizeClass(nsize))
+    {
+        // The block already has room for the new size
+        block = ptr;
+    }
+    else
+    {
+        block = allocateBlock(nsize);
+        if(block)
+        {
+            mStatistics.allocations++;
+
+            if(ptr)
+            {
+                std::memcpy(block, ptr, std::min(osize, nsize));
+                freeBlock(ptr, osize);
+            }
+        }
+        else if(shrinking)
+        {
+            // A kept small block is later freed into the free list of its
+            // new, smaller size class, which is safe since it is larger
+            block = ptr;
+            if(osize > MaxSmallSize)
+                adoptBlock(ptr);
+        }
+        else
+            return nullptr;
+    }
+
+    mStatistics.bytes += nsize - osize;
+    mStatistics.peakBytes = std::max(mStatistics.peakBytes, mStatistics.bytes);
+
+    return block;
+}
+
+void *LuaArena::allocateBlock(std::size_t size)
+{
+    if(size > MaxSmallSize)
+        return std::malloc(size);
+
+    std::size_t index = sizeClass(size);
+    if(FreeBlock *block = mFreeLists[index])
+    {
+        mFreeLists[index] = block->next;
+        return block;
+    }
+
+    // The tail of a page too small for the block is left unused
+    std::size_t blockSize = (index + 1) * Granularity;
+    if(mCursor == nullptr || (std::size_t)(mEnd - mCursor) < blockSize)
+    {
+        char *page = static_cast<char*>(std::malloc(PageSize));
+        if(!page)
+            return nullptr;
+
+        // Lua expects a null block on failure, not an exception
+        try
+        {
+            mPages.push_back(page);
+        }
+        catch(const std::bad_alloc &)
+        {
+            std::free(page);
+            return nullptr;
+        }
+
+        mCursor = page;
+        mEnd = page + PageSize;
+        mStatistics.pageBytes += PageSize;
+    }
+
+    void *block = mCursor;
+    mCursor += blockSize;
+
+    return block;
+}
+
+void LuaArena::adoptBlock(void *ptr)
+{
+    // A malloc block that became a small block ends up in a free list, it
+    // is released with the pages. If even that fails it leaks, which is
+    // still better than failing a shrink.
+    try
+    {
+        mPages.push_back(static_cast<char*>(ptr));
+    }
+    catch(const std::bad_alloc &)
+    {
+    }
+}
+
+void LuaArena::freeBlock(void *ptr, std::size_t size)
+{
+    if(size > MaxSmallSize)
+    {
+        std::free(ptr);
+        return;
+    }
+
+    auto block = static_cast<FreeBlock*>(ptr);
+    std::size_t index = sizeClass(size);
+    block->next = mFreeLists[index];
+    mFreeLists[index] = block;
+}
+
+} // namespace Gamma
@@ -0,0 +1,111 @@
+//  gamma-viewer-3d - 3d visualization of sessions generated by gamma-analyzer
+//  Copyright (C) 2017  Dag Robole
+//
+//  This program is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef LUAARENA_H
+#define LUAARENA_H
+
+#include <cstddef>
+#include <vector>
+
+namespace Gamma
+{
+
+// Allocator for a single Lua state. Small blocks come from size classes
+// carved out of large pages and are recycled through free lists, larger
+// blocks go to malloc. A state is only used by one thread at a time, so
+// the arena needs no locking.
+class LuaArena
+{
+public:
+
+    struct Statistics
+    {
+        Statistics()
+            :
+              allocations(0),
+              frees(0),
+              bytes(0),
+              peakBytes(0),
+              pageBytes(0) {}
+
+        std::size_t allocations;
+        std::size_t frees;
+        std::size_t bytes;
+        std::size_t peakBytes;
+        std::size_t pageBytes;
+
+        Statistics &operator += (const Statistics &rhs)
+        {
+            allocations += rhs.allocations;
+            frees += rhs.frees;
+            bytes += rhs.bytes;
+            peakBytes += rhs.peakBytes;
+            pageBytes += rhs.pageBytes;
+            return *this;
+        }
+    };
+
+    LuaArena();
+    LuaArena(const LuaArena &rhs) = delete;
+    ~LuaArena();
+
+    LuaArena &operator = (const LuaArena &) = delete;
+
+    // lua_Alloc function, ud is the arena
+    static void *allocate(void *ud, void *ptr, std::size_t osize, std::size_t nsize);
+
+    const Statistics &statistics() const { return mStatistics; }
+
+    // Counters restart from zero, the peak restarts from the bytes in use
+    void resetStatistics();
+
+    // Growing past the limit fails, which Lua reports as a memory error.
+    // Zero means no limit.
+    void setByteLimit(std::size_t bytes) { mByteLimit = bytes; }
+    std::size_t byteLimit() const { return mByteLimit; }
+
+    static const std::size_t Granularity = 16;
+    static const std::size_t MaxSmallSize = 256;
+    static const std::size_t PageSize = 64 * 1024;
+
+private:
+
+    struct FreeBlock
+    {
+        FreeBlock *next;
+    };
+
+    static const std::size_t NumClasses = MaxSmallSize / Granularity;
+
+    void *reallocate(void *ptr, std::size_t osize, std::size_t nsize);
+    void *allocateBlock(std::size_t size);
+    void freeBlock(void *ptr, std::size_t size);
+    void adoptBlock(void *ptr);
+
+    static std::size_t sizeClass(std::size_t size) { return (size - 1) / Granularity; }
+
+    // Pages, and malloc blocks kept as small blocks, freed with the arena
+    std::vector<char*> mPages;
+    char *mCursor;
+    char *mEnd;
+    FreeBlock *mFreeLists[NumClasses];
+    Statistics mStatistics;
+    std::size_t mByteLimit;
+};
+
+} // namespace Gamma
+
+#endif // LUAARENA_H
@@ -0,0 +1,128 @@
+//  gamma-viewer-3d - 3d visualization of sessions generated by gamma-analyzer
+//  Copyright (C) 2017  Dag Robole
+//
+//  This program is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "luabuffer.h"
+#include <algorithm>
+
+namespace Gamma
+{
+
+static const char *MetatableName = "Gamma.LuaBuffer";
+
+static LuaBuffer::View *checkIndex(lua_State *L, lua_Integer &index)
+{
+    auto view = LuaBuffer::checkView(L, 1);
+    index = luaL_checkinteger(L, 2);
+    luaL_argcheck(L, index >= 1 && (std::size_t)index <= view->size, 2, "index out of range");
+
+    return view;
+}
+
+static int bufferIndex(lua_State *L)
+{
+    lua_Integer index;
+    auto view = checkIndex(L, index);
+
+    if(view->isInteger)
+        lua_pushinteger(L, static_cast<const int*>(view->data)[index - 1]);
+    else
+        lua_pushnumber(L, static_cast<const double*>(view->data)[index - 1]);
+
+    return 1;
+}
+
+static int bufferNewIndex(lua_State *L)
+{
+    lua_Integer index;
+    auto view = checkIndex(L, index);
+    luaL_argcheck(L, view->writable, 1, "buffer is read-only");
+
+    static_cast<double*>(view->data)[index - 1] = luaL_checknumber(L, 3);
+
+    return 0;
+}
+
+static int bufferLength(lua_State *L)
+{
+    auto view = LuaBuffer::checkView(L, 1);
+    lua_pushinteger(L, (lua_Integer)view->size);
+
+    return 1;
+}
+
+LuaBuffer::View *LuaBuffer::pushView(lua_State *L, const int *data, std::size_t size)
+{
+    return newView(L, const_cast<int*>(data), size, true, false);
+}
+
+LuaBuffer::View *LuaBuffer::pushView(lua_State *L, const double *data, std::size_t size)
+{
+    return newView(L, const_cast<double*>(data), size, false, false);
+}
+
+LuaBuffer::View *LuaBuffer::pushWritableView(lua_State *L, double *data, std::size_t size)
+{
+    return newView(L, data, size, false, true);
+}
+
+LuaBuffer::View *LuaBuffer::pushCopy(lua_State *L, const int *data, std::size_t size)
+{
+    // The copy lives in the same userdata block, right after the view
+    auto view = static_cast<View*>(lua_newuserdata(L, sizeof(View) + size * sizeof(int)));
+    int *copy = reinterpret_cast<int*>(view + 1);
+    std::copy(data, data + size, copy);
+
+    view->data = copy;
+    view->size = size;
+    view->isInteger = true;
+    view->writable = false;
+    setMetatable(L);
+
+    return view;
+}
+
+LuaBuffer::View *LuaBuffer::checkView(lua_State *L, int arg)
+{
+    return static_cast<View*>(luaL_checkudata(L, arg, MetatableName));
+}
+
+LuaBuffer::View *LuaBuffer::newView(lua_State *L, void *data, std::size_t size, bool isInteger, bool writable)
+{
+    auto view = static_cast<View*>(lua_newuserdata(L, sizeof(View)));
+    view->data = data;
+    view->size = size;
+    view->isInteger = isInteger;
+    view->writable = writable;
+    setMetatable(L);
+
+    return view;
+}
+
+void LuaBuffer::setMetatable(lua_State *L)
+{
+    if(luaL_newmetatable(L, MetatableName))
+    {
+        lua_pushcfunction(L, bufferIndex);
+        lua_setfield(L, -2, "__index");
+        lua_pushcfunction(L, bufferNewIndex);
+        lua_setfield(L, -2, "__newindex");
+        lua_pushcfunction(L, bufferLength);
+        lua_setfield(L, -2, "__len");
+    }
+    lua_setmetatable(L, -2);
+}
+
+} // namespace Gamma
@@ -0,0 +1,68 @@
+//  gamma-viewer-3d - 3d visualization of sessions generated by gamma-analyzer
+//  Copyright (C) 2017  Dag Robole
+//
+//  This program is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef LUABUFFER_H
+#define LUABUFFER_H
+
+#include <cstddef>
+
+extern "C"
+{
+#include "lua/lua.h"
+#include "lua/lualib.h"
+#include "lua/lauxlib.h"
+}
+
+namespace Gamma
+{
+
+// Exposes a C array to Lua as userdata without copying it. Scripts index
+// the buffer from 1 like a table and get its size with #.
+class LuaBuffer
+{
+public:
+
+    struct View
+    {
+        void *data;
+        std::size_t size;
+        bool isInteger;
+        bool writable;
+    };
+
+    // Pushes a read-only view, the data must outlive the state
+    static View *pushView(lua_State *L, const int *data, std::size_t size);
+    static View *pushView(lua_State *L, const double *data, std::size_t size);
+
+    // Pushes a view scripts can assign numbers through, the data must
+    // outlive the state
+    static View *pushWritableView(lua_State *L, double *data, std::size_t size);
+
+    // Pushes a read-only buffer holding its own copy of the data
+    static View *pushCopy(lua_State *L, const int *data, std::size_t size);
+
+    // Checks that argument arg is a buffer and returns its view
+    static View *checkView(lua_State *L, int arg);
+
+private:
+
+    static void setMetatable(lua_State *L);
+    static View *newView(lua_State *L, void *data, std::size_t size, bool isInteger, bool writable);
+};
+
+} // namespace Gamma
+
+#endif // LUABUFFER_H
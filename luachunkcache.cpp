@@ -0,0 +1,232 @@
+//  gamma-viewer-3d - 3d visualization of sessions generated by gamma-analyzer
+//  Copyright (C) 2017  Dag Robole
+//
+//  This program is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "luachunkcache.h"
+#include "luastate.h"
+#include <QFile>
+#include <QFileInfo>
+#include <QDir>
+#include <QStandardPaths>
+#include <QSaveFile>
+#include <QCryptographicHash>
+#include <QDebug>
+
+namespace Gamma
+{
+
+static const char ChunkMagic[] = "GV3DLUAC";
+
+LuaChunkCache &LuaChunkCache::instance()
+{
+    static LuaChunkCache cache;
+    return cache;
+}
+
+LuaChunkCache::LuaChunkCache()
+{
+    if(qgetenv("GAMMA_VIEWER_LUA_CHUNK_CACHE") != "disk")
+        return;
+
+    // Private to the user, anyone able to write chunks could run native code
+    QString cacheLocation = QStandardPaths::writableLocation(QStandardPaths::CacheLocation);
+    if(cacheLocation.isEmpty())
+        return;
+
+    QString directory = cacheLocation + "/lua-chunks";
+    if(!QDir().mkpath(directory) ||
+            !QFile::setPermissions(directory, QFile::ReadOwner | QFile::WriteOwner | QFile::ExeOwner))
+    {
+        qDebug() << "Unable to create Lua chunk cache:" << directory;
+        return;
+    }
+
+    mDiskCacheDirectory = directory;
+}
+
+void LuaChunkCache::clear()
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+    mChunks.clear();
+}
+
+static QString chunkName(const QString &scriptFileName)
+{
+    // Same chunk name as luaL_loadfile, so error messages name the file
+    return "@" + scriptFileName;
+}
+
+int LuaChunkCache::load(lua_State *L, QString scriptFileName)
+{
+    QByteArray bytecode;
+    if(findChunk(scriptFileName, bytecode))
+    {
+        int status = luaL_loadbufferx(L, bytecode.constData(), (std::size_t)bytecode.size(),
+                                      chunkName(scriptFileName).toUtf8().constData(), "b");
+        if(status == LUA_OK)
+            return status;
+
+        // A chunk from another Lua build, compile from source instead
+        lua_pop(L, 1);
+    }
+
+    Chunk chunk;
+    int status = compile(L, scriptFileName, chunk);
+    if(status != LUA_OK)
+        return status;
+
+    if(!mDiskCacheDirectory.isEmpty())
+        writeDiskChunk(chunk);
+
+    std::lock_guard<std::mutex> lock(mMutex);
+    mChunks[scriptFileName] = chunk;
+
+    return status;
+}
+
+bool LuaChunkCache::findChunk(const QString &scriptFileName, QByteArray &bytecode)
+{
+    QFileInfo info(scriptFileName);
+    if(!info.exists())
+        return false;
+
+    std::lock_guard<std::mutex> lock(mMutex);
+
+    auto it = mChunks.find(scriptFileName);
+    if(it == mChunks.end() && !mDiskCacheDirectory.isEmpty())
+    {
+        Chunk chunk;
+        if(readDiskChunk(scriptFileName, chunk))
+            it = mChunks.emplace(scriptFileName, chunk).first;
+    }
+
+    if(it == mChunks.end())
+        return false;
+
+    Chunk &chunk = it->second;
+    if(chunk.size != info.size() || chunk.lastModified != info.lastModified())
+    {
+        // Touched files with unchanged content keep their chunk
+        QFile file(scriptFileName);
+        if(!file.open(QIODevice::ReadOnly))
+            return false;
+
+        QByteArray hash = QCryptographicHash::hash(file.readAll(), QCryptographicHash::Sha1);
+        if(hash != chunk.hash)
+        {
+            mChunks.erase(it);
+            return false;
+        }
+
+        chunk.size = info.size();
+        chunk.lastModified = info.lastModified();
+    }
+
+    bytecode = chunk.bytecode;
+    return true;
+}
+
+static int writeBytecode(lua_State *, const void *p, std::size_t size, void *ud)
+{
+    static_cast<QByteArray*>(ud)->append(static_cast<const char*>(p), (int)size);
+    return 0;
+}
+
+int LuaChunkCache::compile(lua_State *L, const QString &scriptFileName, Chunk &chunk)
+{
+    QFile file(scriptFileName);
+    if(!file.open(QIODevice::ReadOnly))
+    {
+        lua_pushfstring(L, "cannot open %s", scriptFileName.toUtf8().constData());
+        return LUA_ERRFILE;
+    }
+
+    QFileInfo info(scriptFileName);
+    QByteArray source = file.readAll();
+
+    int status = luaL_loadbufferx(L, source.constData(), (std::size_t)source.size(),
+                                  chunkName(scriptFileName).toUtf8().constData(), "t");
+    if(status != LUA_OK)
+        return status;
+
+    // Debug information is kept for line numbers in script errors
+    chunk.size = info.size();
+    chunk.lastModified = info.lastModified();
+    chunk.hash = QCryptographicHash::hash(source, QCryptographicHash::Sha1);
+    chunk.bytecode.clear();
+    lua_dump(L, &writeBytecode, &chunk.bytecode, 0);
+
+    return status;
+}
+
+QString LuaChunkCache::diskChunkFileName(const QByteArray &hash) const
+{
+    // Lua builds with other bytecode formats get their own files
+    return mDiskCacheDirectory + "/" + QString::fromLatin1(hash.toHex())
+            + "-" + QString::number(LUA_VERSION_NUM) + ".gv3dchunk";
+}
+
+bool LuaChunkCache::readDiskChunk(const QString &scriptFileName, Chunk &chunk) const
+{
+    // The chunk is looked up by the hash of the source as it is now, a hash
+    // stored in the chunk file alone proves nothing
+    QFileInfo info(scriptFileName);
+    QFile source(scriptFileName);
+    if(!source.open(QIODevice::ReadOnly))
+        return false;
+
+    QByteArray hash = QCryptographicHash::hash(source.readAll(), QCryptographicHash::Sha1);
+
+    QFile file(diskChunkFileName(hash));
+    if(!file.open(QIODevice::ReadOnly))
+        return false;
+
+    QByteArray data = file.readAll();
+    const int headerSize = (int)sizeof(ChunkMagic) - 1;
+    const int hashSize = 20;
+
+    if(data.size() <= headerSize + hashSize || !data.startsWith(ChunkMagic) ||
+            data.mid(headerSize, hashSize) != hash)
+        return false;
+
+    chunk.size = info.size();
+    chunk.lastModified = info.lastModified();
+    chunk.hash = hash;
+    chunk.bytecode = data.mid(headerSize + hashSize);
+
+    return true;
+}
+
+void LuaChunkCache::writeDiskChunk(const Chunk &chunk) const
+{
+    // Writing never fails a load, a chunk that can not be written is skipped
+    QSaveFile file(diskChunkFileName(chunk.hash));
+    if(!file.open(QIODevice::WriteOnly) ||
+            file.write(ChunkMagic, sizeof(ChunkMagic) - 1) < 0 ||
+            file.write(chunk.hash) != chunk.hash.size() ||
+            file.write(chunk.bytecode) != chunk.bytecode.size() ||
+            !file.commit())
+        qDebug() << "Unable to write Lua chunk cache:" << file.fileName();
+}
+
+bool runLuaScript(lua_State *L, QString scriptFileName)
+{
+    LuaBudget budget(L);
+
+    return LuaChunkCache::instance().load(L, scriptFileName) == LUA_OK &&
+            lua_pcall(L, 0, LUA_MULTRET, 0) == LUA_OK;
+}
+
+} // namespace Gamma
@@ -0,0 +1,86 @@
+//  gamma-viewer-3d - 3d visualization of sessions generated by gamma-analyzer
+//  Copyright (C) 2017  Dag Robole
+//
+//  This program is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef LUACHUNKCACHE_H
+#define LUACHUNKCACHE_H
+
+#include <map>
+#include <mutex>
+#include <QString>
+#include <QByteArray>
+#include <QDateTime>
+
+extern "C"
+{
+#include "lua/lua.h"
+#include "lua/lualib.h"
+#include "lua/lauxlib.h"
+}
+
+namespace Gamma
+{
+
+// Compiled doserate scripts, shared by every Lua state in the process so a
+// script is parsed once however many sessions and workers load it. Chunks
+// are keyed by script path and content hash and are recompiled when the
+// file changes. With GAMMA_VIEWER_LUA_CHUNK_CACHE=disk the chunks are also
+// kept on disk, named by the hash of their source, in a cache directory only
+// the user can write to. Lua does not verify bytecode, so binary chunks are
+// never loaded from anywhere else.
+class LuaChunkCache
+{
+public:
+
+    static LuaChunkCache &instance();
+
+    // Pushes the main function of the script like luaL_loadfile, returns a
+    // Lua status code
+    int load(lua_State *L, QString scriptFileName);
+
+    void clear();
+
+private:
+
+    LuaChunkCache();
+    LuaChunkCache(const LuaChunkCache &rhs) = delete;
+    LuaChunkCache &operator = (const LuaChunkCache &) = delete;
+
+    struct Chunk
+    {
+        qint64 size;
+        QDateTime lastModified;
+        QByteArray hash;
+        QByteArray bytecode;
+    };
+
+    bool findChunk(const QString &scriptFileName, QByteArray &bytecode);
+    int compile(lua_State *L, const QString &scriptFileName, Chunk &chunk);
+    QString diskChunkFileName(const QByteArray &hash) const;
+    bool readDiskChunk(const QString &scriptFileName, Chunk &chunk) const;
+    void writeDiskChunk(const Chunk &chunk) const;
+
+    std::mutex mMutex;
+    std::map<QString, Chunk> mChunks;
+    QString mDiskCacheDirectory;
+};
+
+// Loads a script through the chunk cache and runs it, returns false and
+// leaves the error message on the stack on failure
+bool runLuaScript(lua_State *L, QString scriptFileName);
+
+} // namespace Gamma
+
+#endif // LUACHUNKCACHE_H
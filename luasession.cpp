@@ -0,0 +1,323 @@
+//  gamma-viewer-3d - 3d visualization of sessions generated by gamma-analyzer
+//  Copyright (C) 2017  Dag Robole
+//
+//  This program is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "luasession.h"
+#include "luastate.h"
+#include "luabuffer.h"
+#include "luachunkcache.h"
+#include "sessionreader.h"
+#include <exception>
+#include <QByteArray>
+
+namespace Gamma
+{
+
+static double viewValue(const LuaBuffer::View *view, std::size_t index)
+{
+    return view->isInteger
+            ? (double)static_cast<const int*>(view->data)[index]
+            : static_cast<const double*>(view->data)[index];
+}
+
+// Converts optional 1-based first and last arguments to a 0-based range
+static void checkRange(lua_State *L, const LuaBuffer::View *view, int arg,
+                       std::size_t &begin, std::size_t &end)
+{
+    lua_Integer first = luaL_optinteger(L, arg, 1);
+    lua_Integer last = luaL_optinteger(L, arg + 1, (lua_Integer)view->size);
+
+    luaL_argcheck(L, first >= 1, arg, "index out of range");
+    luaL_argcheck(L, last <= (lua_Integer)view->size, arg + 1, "index out of range");
+
+    begin = (std::size_t)(first - 1);
+    end = last >= first ? (std::size_t)last : begin;
+}
+
+static int gammaSum(lua_State *L)
+{
+    auto view = LuaBuffer::checkView(L, 1);
+    std::size_t begin, end;
+    checkRange(L, view, 2, begin, end);
+
+    double sum = 0.0;
+    if(view->isInteger)
+    {
+        auto data = static_cast<const int*>(view->data);
+        for(std::size_t i = begin; i < end; i++)
+            sum += data[i];
+    }
+    else
+    {
+        auto data = static_cast<const double*>(view->data);
+        for(std::size_t i = begin; i < end; i++)
+            sum += data[i];
+    }
+
+    lua_pushnumber(L, sum);
+    return 1;
+}
+
+static int gammaDot(lua_State *L)
+{
+    auto view = LuaBuffer::checkView(L, 1);
+    lua_Integer first = luaL_optinteger(L, 3, 1);
+    luaL_argcheck(L, first >= 1, 3, "index out of range");
+    std::size_t begin = (std::size_t)(first - 1);
+
+    double sum = 0.0;
+    if(lua_istable(L, 2))
+    {
+        std::size_t count = (std::size_t)luaL_len(L, 2);
+        luaL_argcheck(L, begin + count <= view->size, 2, "weights reach past the buffer");
+
+        for(std::size_t i = 0; i < count; i++)
+        {
+            lua_rawgeti(L, 2, (lua_Integer)(i + 1));
+            sum += viewValue(view, begin + i) * lua_tonumber(L, -1);
+            lua_pop(L, 1);
+        }
+    }
+    else
+    {
+        auto weights = LuaBuffer::checkView(L, 2);
+        luaL_argcheck(L, begin + weights->size <= view->size, 2, "weights reach past the buffer");
+
+        for(std::size_t i = 0; i < weights->size; i++)
+            sum += viewValue(view, begin + i) * viewValue(weights, i);
+    }
+
+    lua_pushnumber(L, sum);
+    return 1;
+}
+
+static int gammaArgmax(lua_State *L)
+{
+    auto view = LuaBuffer::checkView(L, 1);
+    std::size_t begin, end;
+    checkRange(L, view, 2, begin, end);
+
+    if(begin >= end)
+    {
+        lua_pushnil(L);
+        lua_pushnil(L);
+        return 2;
+    }
+
+    std::size_t best = begin;
+    double bestValue = viewValue(view, begin);
+    for(std::size_t i = begin + 1; i < end; i++)
+    {
+        double value = viewValue(view, i);
+        if(value > bestValue)
+        {
+            best = i;
+            bestValue = value;
+        }
+    }
+
+    lua_pushinteger(L, (lua_Integer)(best + 1));
+    lua_pushnumber(L, bestValue);
+    return 2;
+}
+
+int openGammaModule(lua_State *L)
+{
+    static const luaL_Reg functions[] = {
+        { "sum", gammaSum },
+        { "dot", gammaDot },
+        { "argmax", gammaArgmax },
+        { nullptr, nullptr }
+    };
+
+    luaL_newlib(L, functions);
+    return 1;
+}
+
+struct StoredChannels
+{
+    const std::vector<int> *channels;
+    const char *error;
+};
+
+static int pushChannelsOrError(lua_State *L)
+{
+    auto stored = static_cast<const StoredChannels*>(lua_touserdata(L, 1));
+    if(stored->error)
+        lua_pushstring(L, stored->error);
+    else
+        LuaBuffer::pushCopy(L, stored->channels->data(), stored->channels->size());
+
+    return 1;
+}
+
+static bool pushStoredChannels(lua_State *L, const Session &session, SessionReader &reader,
+                               SpectrumStoreSize index)
+{
+    // Lua errors must not unwind through C++ frames. The copy is pushed
+    // under a protected call, the caller raises any error once the vector
+    // is gone
+    std::vector<int> channels;
+    QByteArray error;
+    try
+    {
+        int sessionIndex = session.spectrumStore().sessionIndices()[index];
+        if(!reader.readChannels(sessionIndex, channels))
+            throw Session::Exception_SpectrumNotFound(QString::number(sessionIndex));
+    }
+    catch(const std::exception &e)
+    {
+        error = e.what();
+    }
+
+    StoredChannels stored = { &channels, error.isNull() ? nullptr : error.constData() };
+    lua_pushcfunction(L, pushChannelsOrError);
+    lua_pushlightuserdata(L, &stored);
+
+    return lua_pcall(L, 1, 1, 0) == LUA_OK && !stored.error;
+}
+
+static int sessionChannels(lua_State *L)
+{
+    auto session = static_cast<const Session*>(lua_touserdata(L, lua_upvalueindex(1)));
+    auto reader = static_cast<SessionReader*>(lua_touserdata(L, lua_upvalueindex(2)));
+    lua_Integer index = luaL_checkinteger(L, 1);
+    luaL_argcheck(L, index >= 1 && (SpectrumStoreSize)index <= session->spectrumCount(),
+                  1, "index out of range");
+
+    // Channels in memory are viewed in place, lazy sessions read a copy
+    if(!session->lazyChannels())
+    {
+        const SpectrumStore &store = session->spectrumStore();
+        LuaBuffer::pushView(L, store.channels((SpectrumStoreSize)index - 1),
+                            store.numChannels((SpectrumStoreSize)index - 1));
+        return 1;
+    }
+
+    if(!reader)
+        return luaL_error(L, "channels are not available");
+
+    if(!pushStoredChannels(L, *session, *reader, (SpectrumStoreSize)index - 1))
+        return lua_error(L);
+
+    return 1;
+}
+
+template<typename T>
+static void setColumn(lua_State *L, const char *name, const std::vector<T> &column)
+{
+    LuaBuffer::pushView(L, column.data(), column.size());
+    lua_setfield(L, -2, name);
+}
+
+void pushLuaSession(lua_State *L, const Session &session, SessionReader *reader)
+{
+    const SpectrumStore &store = session.spectrumStore();
+
+    lua_newtable(L);
+
+    lua_pushinteger(L, (lua_Integer)session.spectrumCount());
+    lua_setfield(L, -2, "count");
+    lua_pushstring(L, session.name().toUtf8().constData());
+    lua_setfield(L, -2, "name");
+
+    setColumn(L, "energies", session.detector().energyTable());
+    setColumn(L, "livetimes", store.livetimes());
+    setColumn(L, "realtimes", store.realtimes());
+    setColumn(L, "latitudes", store.latitudes());
+    setColumn(L, "longitudes", store.longitudes());
+    setColumn(L, "altitudes", store.altitudes());
+    setColumn(L, "doserates", store.doserates());
+
+    lua_pushlightuserdata(L, const_cast<Session*>(&session));
+    lua_pushlightuserdata(L, reader);
+    lua_pushcclosure(L, sessionChannels, 2);
+    lua_setfield(L, -2, "channels");
+}
+
+static int requireGammaModule(lua_State *L)
+{
+    luaL_requiref(L, "gamma", openGammaModule, 1);
+    return 0;
+}
+
+struct AnalysisArguments
+{
+    const Session *session;
+    SessionReader *reader;
+    double *result;
+    std::size_t count;
+};
+
+static int pushAnalysisArguments(lua_State *L)
+{
+    auto args = static_cast<const AnalysisArguments*>(lua_touserdata(L, 1));
+    pushLuaSession(L, *args->session, args->reader);
+    LuaBuffer::pushWritableView(L, args->result, args->count);
+
+    return 2;
+}
+
+std::vector<double> runAnalysisScript(const Session &session,
+                                      QString scriptFileName,
+                                      const std::atomic_bool &cancelled)
+{
+    // The result and reader are declared first so they outlive the state,
+    // finalizers run by lua_close can still reach them
+    std::vector<double> result(session.spectrumCount(), 0.0);
+
+    // Lazy channels are read on a connection of this thread
+    std::unique_ptr<SessionReader> reader;
+    if(session.lazyChannels())
+        reader = session.makeReader("Analysis");
+
+    auto L = newLuaState();
+    if(!L)
+        throw Exception_AnalysisScriptFailed("Unable to create Lua state");
+
+    setLuaCancelFlag(L.get(), &cancelled);
+
+    // Analyses cover a whole session in one call, not a chunk of spectra
+    LuaLimits limits;
+    limits.maxInstructions *= 50;
+    limits.timeoutMsecs *= 10;
+    setLuaLimits(L.get(), limits);
+
+    // Everything allocating on the state runs protected, a memory error
+    // fails the analysis instead of reaching the panic handler
+    lua_pushcfunction(L.get(), requireGammaModule);
+    if(lua_pcall(L.get(), 0, 0, 0) != LUA_OK)
+        throw Exception_AnalysisScriptFailed(lua_tostring(L.get(), -1));
+
+    if(!runLuaScript(L.get(), scriptFileName))
+        throw Exception_AnalysisScriptFailed(lua_tostring(L.get(), -1));
+
+    if(lua_getglobal(L.get(), "analyze") != LUA_TFUNCTION)
+        throw Exception_AnalysisScriptFailed(scriptFileName + ": analyze is not defined");
+
+    AnalysisArguments args = { &session, reader.get(), result.data(), result.size() };
+    lua_pushcfunction(L.get(), pushAnalysisArguments);
+    lua_pushlightuserdata(L.get(), &args);
+    if(lua_pcall(L.get(), 1, 2, 0) != LUA_OK)
+        throw Exception_AnalysisScriptFailed(lua_tostring(L.get(), -1));
+
+    LuaBudget budget(L.get());
+    if(lua_pcall(L.get(), 2, 0, 0) != LUA_OK)
+        throw Exception_AnalysisScriptFailed(lua_tostring(L.get(), -1));
+
+    return result;
+}
+
+} // namespace Gamma
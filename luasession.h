@@ -0,0 +1,66 @@
+//  gamma-viewer-3d - 3d visualization of sessions generated by gamma-analyzer
+//  Copyright (C) 2017  Dag Robole
+//
+//  This program is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef LUASESSION_H
+#define LUASESSION_H
+
+#include "exceptions.h"
+#include "session.h"
+#include <atomic>
+#include <vector>
+#include <QString>
+
+extern "C"
+{
+#include "lua/lua.h"
+#include "lua/lualib.h"
+#include "lua/lauxlib.h"
+}
+
+namespace Gamma
+{
+
+// Opens the gamma module with bulk operations on buffers, implemented in C
+// so per-channel loops stay out of the interpreter:
+//   gamma.sum(buffer [, first [, last]])
+//   gamma.dot(buffer, weights [, first])      weights is a table or buffer
+//   gamma.argmax(buffer [, first [, last]])   returns index and value
+int openGammaModule(lua_State *L);
+
+// Pushes a table describing a loaded session. Columns are read-only views
+// of the session arrays, indexed from 1:
+//   count, name, livetime, energies, livetimes, realtimes, latitudes,
+//   longitudes, altitudes, doserates, channels(i)
+// Lazy channels are read through reader, channels(i) fails without one.
+// The session and reader must outlive the state.
+void pushLuaSession(lua_State *L, const Session &session, SessionReader *reader);
+
+// Runs analyze(session, result) of an analysis script on a fresh state.
+// The script writes one value per spectrum into result, which is returned.
+// Meant for a worker thread, the script fails once cancelled is set.
+std::vector<double> runAnalysisScript(const Session &session,
+                                      QString scriptFileName,
+                                      const std::atomic_bool &cancelled);
+
+struct Exception_AnalysisScriptFailed : public Exception
+{
+    explicit Exception_AnalysisScriptFailed(QString source) noexcept
+        : Exception("Analysis script failed: " + source) {}
+};
+
+} // namespace Gamma
+
+#endif // LUASESSION_H
@@ -0,0 +1,453 @@
+//  gamma-viewer-3d - 3d visualization of sessions generated by gamma-analyzer
+//  Copyright (C) 2017  Dag Robole
+//
+//  This program is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "luastate.h"
+#include "luachunkcache.h"
+#include <algorithm>
+#include <exception>
+#include <map>
+#include <QRunnable>
+#include <QSemaphore>
+#include <QThread>
+#include <QThreadPool>
+
+namespace Gamma
+{
+
+// Budget bookkeeping of a state, kept in the extra space of the state
+struct LuaWatchdog
+{
+    LuaWatchdog() : cancelled(nullptr), instructions(0), scriptTime(0) {}
+
+    LuaLimits limits;
+    const std::atomic_bool *cancelled;
+    qint64 instructions;
+    QElapsedTimer timer;
+    qint64 scriptTime;
+};
+
+// Instructions between two checks of the budget
+static const int HookInterval = 1000;
+
+static LuaWatchdog *luaWatchdog(lua_State *L)
+{
+    if(!luaArena(L))
+        return nullptr;
+
+    return *static_cast<LuaWatchdog**>(lua_getextraspace(L));
+}
+
+static void budgetHook(lua_State *L, lua_Debug *)
+{
+    LuaWatchdog *watchdog = luaWatchdog(L);
+    if(!watchdog)
+        return;
+
+    // Calls made outside a budget start the clock on the first check
+    if(!watchdog->timer.isValid())
+        watchdog->timer.start();
+
+    if(watchdog->cancelled && *watchdog->cancelled)
+        luaL_error(L, "cancelled");
+
+    watchdog->instructions += HookInterval;
+    if(watchdog->instructions > watchdog->limits.maxInstructions)
+        luaL_error(L, "instruction budget of %I exceeded",
+                   (lua_Integer)watchdog->limits.maxInstructions);
+
+    if(watchdog->timer.elapsed() > watchdog->limits.timeoutMsecs)
+        luaL_error(L, "timed out after %I ms",
+                   (lua_Integer)watchdog->limits.timeoutMsecs);
+}
+
+void LuaStateDeleter::operator () (lua_State *L) const
+{
+    if(!L)
+        return;
+
+    LuaArena *arena = luaArena(L);
+    LuaWatchdog *watchdog = luaWatchdog(L);
+    lua_close(L);
+    delete watchdog;
+    delete arena;
+}
+
+static int panic(lua_State *L)
+{
+    // Same as the panic function installed by luaL_newstate
+    lua_writestringerror("PANIC: unprotected error in call to Lua API (%s)\n",
+                         lua_tostring(L, -1));
+    return 0;
+}
+
+LuaStatePointer newLuaState()
+{
+    auto arena = std::make_unique<LuaArena>();
+
+    LuaStatePointer L(lua_newstate(&LuaArena::allocate, arena.get()));
+    if(!L)
+        return L;
+
+    // The state owns the arena and watchdog from here, the deleter
+    // releases them
+    arena.release()->setByteLimit(LuaLimits().maxBytes);
+    *static_cast<LuaWatchdog**>(lua_getextraspace(L.get())) = new LuaWatchdog;
+
+    lua_atpanic(L.get(), &panic);
+    lua_sethook(L.get(), &budgetHook, LUA_MASKCOUNT, HookInterval);
+    luaL_openlibs(L.get());
+
+    return L;
+}
+
+LuaArena *luaArena(lua_State *L)
+{
+    void *ud = nullptr;
+    if(lua_getallocf(L, &ud) != &LuaArena::allocate)
+        return nullptr;
+
+    return static_cast<LuaArena*>(ud);
+}
+
+void setLuaLimits(lua_State *L, const LuaLimits &limits)
+{
+    if(LuaWatchdog *watchdog = luaWatchdog(L))
+        watchdog->limits = limits;
+
+    if(LuaArena *arena = luaArena(L))
+        arena->setByteLimit(limits.maxBytes);
+}
+
+void setLuaCancelFlag(lua_State *L, const std::atomic_bool *cancelled)
+{
+    if(LuaWatchdog *watchdog = luaWatchdog(L))
+        watchdog->cancelled = cancelled;
+}
+
+LuaBudget::LuaBudget(lua_State *L)
+    :
+      L(L)
+{
+    if(LuaWatchdog *watchdog = luaWatchdog(L))
+    {
+        watchdog->instructions = 0;
+        watchdog->timer.start();
+    }
+}
+
+LuaBudget::~LuaBudget()
+{
+    if(LuaWatchdog *watchdog = luaWatchdog(L))
+    {
+        watchdog->scriptTime += watchdog->timer.nsecsElapsed();
+        watchdog->timer.invalidate();
+    }
+}
+
+qint64 luaScriptTime(lua_State *L)
+{
+    LuaWatchdog *watchdog = luaWatchdog(L);
+    return watchdog ? watchdog->scriptTime : 0;
+}
+
+void resetLuaScriptTime(lua_State *L)
+{
+    if(LuaWatchdog *watchdog = luaWatchdog(L))
+        watchdog->scriptTime = 0;
+}
+
+// Pops the error of a failed protected call and throws it
+static void throwScriptError(lua_State *L, int status, const char *function)
+{
+    QString message;
+    if(status == LUA_ERRMEM)
+        message = "memory limit exceeded";
+    else if(const char *error = lua_tostring(L, -1))
+        message = error;
+    else
+        message = "unknown error";
+    lua_pop(L, 1);
+
+    throw Exception_LuaScriptFailed(QString(function) + ": " + message);
+}
+
+double luaGEValue(lua_State *L, double energy)
+{
+    double ge;
+
+    lua_getglobal(L, "gevalue");
+    lua_pushnumber(L, energy);
+    int status = lua_pcall(L, 1, 1, 0);
+    if(status != LUA_OK)
+        throwScriptError(L, status, "gevalue");
+    ge = (double)lua_tonumber(L, -1);
+    lua_pop(L, 1);
+
+    return ge;
+}
+
+bool hasGEValueBatch(lua_State *L)
+{
+    bool found = lua_getglobal(L, "gevalue_batch") == LUA_TFUNCTION;
+    lua_pop(L, 1);
+
+    return found;
+}
+
+static void pushNumberTable(lua_State *L, const double *data, std::size_t count)
+{
+    lua_createtable(L, (int)count, 0);
+    for(std::size_t i = 0; i < count; i++)
+    {
+        lua_pushnumber(L, data[i]);
+        lua_rawseti(L, -2, (lua_Integer)i + 1);
+    }
+}
+
+static void pushIntegerTable(lua_State *L, const int *data, std::size_t count)
+{
+    lua_createtable(L, (int)count, 0);
+    for(std::size_t i = 0; i < count; i++)
+    {
+        lua_pushinteger(L, data[i]);
+        lua_rawseti(L, -2, (lua_Integer)i + 1);
+    }
+}
+
+struct GEValueBatch
+{
+    const double *energies;
+    std::size_t count;
+    const int *counts;
+};
+
+// Builds the argument tables and calls gevalue_batch, run under lua_pcall
+// so a memory error while marshalling fails like a script error
+static int callGEValueBatch(lua_State *L)
+{
+    auto batch = static_cast<const GEValueBatch*>(lua_touserdata(L, 1));
+
+    lua_createtable(L, (int)batch->count, 0);
+    int weightTable = lua_gettop(L);
+
+    lua_getglobal(L, "gevalue_batch");
+    pushNumberTable(L, batch->energies, batch->count);
+    lua_pushvalue(L, weightTable);
+    if(batch->counts)
+        pushIntegerTable(L, batch->counts, batch->count);
+    else
+        lua_pushnil(L);
+
+    lua_call(L, 3, 0);
+
+    return 1;
+}
+
+void luaGEValueBatch(lua_State *L,
+                     const double *energies,
+                     double *weights,
+                     std::size_t count,
+                     const int *counts)
+{
+    if(!lua_checkstack(L, 3))
+        throw Exception_LuaScriptFailed("gevalue_batch: stack overflow");
+
+    // The trampoline returns the weights table so it can be read back
+    GEValueBatch batch = { energies, count, counts };
+    lua_pushcfunction(L, callGEValueBatch);
+    lua_pushlightuserdata(L, &batch);
+
+    int status = lua_pcall(L, 1, 1, 0);
+    if(status != LUA_OK)
+        throwScriptError(L, status, "gevalue_batch");
+
+    int weightTable = lua_gettop(L);
+
+    // Weights the script left unset are zero
+    for(std::size_t i = 0; i < count; i++)
+    {
+        lua_rawgeti(L, weightTable, (lua_Integer)i + 1);
+        int isNumber = 0;
+        weights[i] = (double)lua_tonumberx(L, -1, &isNumber);
+        bool isNil = lua_isnil(L, -1);
+        lua_pop(L, 1);
+        if(!isNumber && !isNil)
+        {
+            lua_pop(L, 1);
+            throw Exception_LuaScriptFailed("gevalue_batch: weight " + QString::number(i + 1) +
+                                            " is not a number");
+        }
+    }
+    lua_pop(L, 1);
+}
+
+bool isGEValueCacheable(lua_State *L)
+{
+    lua_getglobal(L, "gevalue_cacheable");
+    bool cacheable = lua_isnil(L, -1) || lua_toboolean(L, -1);
+    lua_pop(L, 1);
+
+    return cacheable;
+}
+
+LuaStatePool::LuaStatePool(QString scriptFileName, unsigned int size)
+{
+    for(unsigned int i = 0; i < std::max(size, 1u); i++)
+    {
+        auto L = newLuaState();
+        if(!L)
+            throw Exception_UnableToCreateLuaState("LuaStatePool::LuaStatePool");
+
+        if(!runLuaScript(L.get(), scriptFileName))
+            throw Exception_LoadScriptFailed(scriptFileName + ": " + lua_tostring(L.get(), -1));
+
+        mStates.push_back(std::move(L));
+    }
+}
+
+std::shared_ptr<LuaStatePool> LuaStatePool::shared(QString key, QString scriptFileName)
+{
+    static std::mutex registryMutex;
+    static std::map<QString, std::weak_ptr<LuaStatePool>> registry;
+
+    {
+        std::lock_guard<std::mutex> lock(registryMutex);
+        if(auto pool = registry[key].lock())
+            return pool;
+    }
+
+    // Scripts run outside the lock, a pool made meanwhile by another
+    // session wins
+    auto pool = std::make_shared<LuaStatePool>(
+                scriptFileName, (unsigned int)QThread::idealThreadCount());
+
+    std::lock_guard<std::mutex> lock(registryMutex);
+    if(auto existing = registry[key].lock())
+        return existing;
+
+    registry[key] = pool;
+    return pool;
+}
+
+LuaArena::Statistics LuaStatePool::allocStatistics() const
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+    LuaArena::Statistics total;
+
+    for(auto &L : mStates)
+    {
+        if(LuaArena *arena = luaArena(L.get()))
+            total += arena->statistics();
+    }
+
+    return total;
+}
+
+qint64 LuaStatePool::scriptTime() const
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+    qint64 total = 0;
+    for(auto &L : mStates)
+        total += luaScriptTime(L.get());
+
+    return total;
+}
+
+void LuaStatePool::resetStatistics()
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+    for(auto &L : mStates)
+    {
+        if(LuaArena *arena = luaArena(L.get()))
+            arena->resetStatistics();
+        resetLuaScriptTime(L.get());
+    }
+}
+
+// Worker threads shared by every pool, sized once. They are kept between
+// runs instead of being started for every chunk of spectra.
+class LuaThreadPool : public QThreadPool
+{
+public:
+
+    LuaThreadPool()
+    {
+        setMaxThreadCount(std::max(QThread::idealThreadCount() - 1, 1));
+        setExpiryTimeout(-1);
+    }
+};
+
+class LuaRangeTask : public QRunnable
+{
+public:
+
+    explicit LuaRangeTask(std::function<void()> task) : mTask(std::move(task)) {}
+
+    void run() override { mTask(); }
+
+private:
+
+    std::function<void()> mTask;
+};
+
+static QThreadPool &luaThreadPool()
+{
+    static LuaThreadPool pool;
+    return pool;
+}
+
+void LuaStatePool::run(std::size_t count, const Work &work)
+{
+    std::lock_guard<std::mutex> lock(mMutex);
+
+    std::size_t numRanges = std::min(mStates.size(), count);
+    if(numRanges == 0)
+        return;
+
+    std::vector<std::exception_ptr> errors(numRanges);
+    QSemaphore done;
+
+    auto runRange = [&](std::size_t i) {
+        try
+        {
+            work(mStates[i].get(), count * i / numRanges, count * (i + 1) / numRanges);
+        }
+        catch(...)
+        {
+            errors[i] = std::current_exception();
+        }
+    };
+
+    // The calling thread takes the first range
+    for(std::size_t i = 1; i < numRanges; i++)
+    {
+        luaThreadPool().start(new LuaRangeTask([&, i]() {
+            runRange(i);
+            done.release();
+        }));
+    }
+    runRange(0);
+
+    done.acquire((int)numRanges - 1);
+
+    for(auto &error : errors)
+    {
+        if(error)
+            std::rethrow_exception(error);
+    }
+}
+
+} // namespace Gamma
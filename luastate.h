@@ -0,0 +1,173 @@
+//  gamma-viewer-3d - 3d visualization of sessions generated by gamma-analyzer
+//  Copyright (C) 2017  Dag Robole
+//
+//  This program is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef LUASTATE_H
+#define LUASTATE_H
+
+#include "exceptions.h"
+#include "luaarena.h"
+#include <atomic>
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include <QString>
+#include <QElapsedTimer>
+
+extern "C"
+{
+#include "lua/lua.h"
+#include "lua/lualib.h"
+#include "lua/lauxlib.h"
+}
+
+namespace Gamma
+{
+
+// Closes the state and releases the arena it was created with
+struct LuaStateDeleter
+{
+    void operator () (lua_State *L) const;
+};
+
+typedef std::unique_ptr<lua_State, LuaStateDeleter> LuaStatePointer;
+
+// Returns a state with the standard libraries opened, or null on failure.
+// The state allocates from its own LuaArena.
+LuaStatePointer newLuaState();
+
+// Arena of a state made by newLuaState, null for other states
+LuaArena *luaArena(lua_State *L);
+
+// Limits of one batch of script calls. A script running past them fails
+// with Exception_LuaScriptFailed instead of hanging the load.
+struct LuaLimits
+{
+    LuaLimits()
+        :
+          maxInstructions(2000000000),
+          timeoutMsecs(30000),
+          maxBytes(512 * 1024 * 1024) {}
+
+    qint64 maxInstructions;
+    qint64 timeoutMsecs;
+    std::size_t maxBytes;
+};
+
+// States made by newLuaState start with the default limits
+void setLuaLimits(lua_State *L, const LuaLimits &limits);
+
+// A script running on a state with a cancel flag fails once the flag is
+// set. The flag must outlive its use by the state, null removes it.
+void setLuaCancelFlag(lua_State *L, const std::atomic_bool *cancelled);
+
+// Starts a batch on a state: the instruction count and deadline restart,
+// and the time until the budget ends is added to the script time
+class LuaBudget
+{
+public:
+
+    explicit LuaBudget(lua_State *L);
+    LuaBudget(const LuaBudget &rhs) = delete;
+    ~LuaBudget();
+
+    LuaBudget &operator = (const LuaBudget &) = delete;
+
+private:
+
+    lua_State *L;
+};
+
+// Nanoseconds spent in budgeted batches since the last reset
+qint64 luaScriptTime(lua_State *L);
+void resetLuaScriptTime(lua_State *L);
+
+struct Exception_LuaScriptFailed : public Exception
+{
+    explicit Exception_LuaScriptFailed(QString source) noexcept
+        : Exception("Lua script failed: " + source) {}
+};
+
+// Calls the gevalue function of a doserate script
+double luaGEValue(lua_State *L, double energy);
+
+// Scripts may define gevalue_batch(energies, weights, counts) to fill the
+// weights table for all energies in one call. The arguments are plain
+// tables indexed from 1, filled and read back in one pass each. Counts are
+// passed to scripts that are not cacheable, and are nil for weight tables.
+bool hasGEValueBatch(lua_State *L);
+void luaGEValueBatch(lua_State *L,
+                     const double *energies,
+                     double *weights,
+                     std::size_t count,
+                     const int *counts = nullptr);
+
+// Scripts set gevalue_cacheable = false when gevalue is not a pure function
+// of the energy, doserates are then computed through the script per spectrum
+bool isGEValueCacheable(lua_State *L);
+
+// Independently loaded copies of a doserate script, one per worker thread
+class LuaStatePool
+{
+public:
+
+    typedef std::function<void(lua_State *L, std::size_t begin, std::size_t end)> Work;
+
+    LuaStatePool(QString scriptFileName, unsigned int size);
+    LuaStatePool(const LuaStatePool &rhs) = delete;
+    ~LuaStatePool() = default;
+
+    LuaStatePool &operator = (const LuaStatePool &) = delete;
+
+    // Pool of the script with this key, shared by every session using it
+    // while any of them holds it. The key must cover the script contents.
+    static std::shared_ptr<LuaStatePool> shared(QString key, QString scriptFileName);
+
+    std::size_t size() const { return mStates.size(); }
+
+    // Sums of the arena statistics and script times of all states
+    LuaArena::Statistics allocStatistics() const;
+    qint64 scriptTime() const;
+    void resetStatistics();
+
+    // Splits [0, count) into one contiguous range per state and runs work on
+    // all ranges in parallel, on the calling thread and the threads of a
+    // pool shared by all scripts. Runs of the same pool are serialized.
+    // Exceptions are rethrown after all workers end.
+    void run(std::size_t count, const Work &work);
+
+    struct Exception_UnableToCreateLuaState : public Exception
+    {
+        explicit Exception_UnableToCreateLuaState(QString source) noexcept
+            : Exception("Unable to create Lua state: " + source) {}
+    };
+
+    struct Exception_LoadScriptFailed : public Exception
+    {
+        explicit Exception_LoadScriptFailed(QString filename) noexcept
+            : Exception("Loading Lua script failed: " + filename) {}
+    };
+
+private:
+
+    std::vector<LuaStatePointer> mStates;
+    mutable std::mutex mMutex;
+};
+
+} // namespace Gamma
+
+#endif // LUASTATE_H
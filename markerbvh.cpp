@@ -0,0 +1,236 @@
+//  gamma-viewer-3d - 3d visualization of sessions generated by gamma-analyzer
+//  Copyright (C) 2017  Dag Robole
+//
+//  This program is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "markerbvh.h"
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <utility>
+
+MarkerBVH::MarkerBVH(float radius)
+    :
+      mRadius(radius)
+{
+}
+
+void MarkerBVH::clear()
+{
+    mCenters.clear();
+    mItems.clear();
+    mNodes.clear();
+}
+
+void MarkerBVH::build(const std::vector<QVector3D> &centers)
+{
+    build(centers.data(), centers.size());
+}
+
+void MarkerBVH::build(const QVector3D *centers, std::size_t count)
+{
+    clear();
+    if(count == 0)
+        return;
+
+    mCenters.assign(centers, centers + count);
+    mItems.resize(count);
+    for(std::size_t i = 0; i < mItems.size(); i++)
+        mItems[i] = (unsigned int)i;
+
+    mNodes.reserve(2 * count / LeafSize + 1);
+    buildNodes();
+}
+
+void MarkerBVH::buildNodes()
+{
+    // Iterative over a stack of ranges, children are added in pairs
+    struct Range { unsigned int node; std::size_t begin, end; };
+    std::vector<Range> stack;
+
+    mNodes.emplace_back();
+    stack.push_back({ 0, 0, mItems.size() });
+
+    while(!stack.empty())
+    {
+        Range range = stack.back();
+        stack.pop_back();
+
+        float min[3] = { std::numeric_limits<float>::max(),
+                         std::numeric_limits<float>::max(),
+                         std::numeric_limits<float>::max() };
+        float max[3] = { std::numeric_limits<float>::lowest(),
+                         std::numeric_limits<float>::lowest(),
+                         std::numeric_limits<float>::lowest() };
+
+        for(std::size_t i = range.begin; i < range.end; i++)
+        {
+            const QVector3D &c = mCenters[mItems[i]];
+            for(int axis = 0; axis < 3; axis++)
+            {
+                min[axis] = std::min(min[axis], c[axis]);
+                max[axis] = std::max(max[axis], c[axis]);
+            }
+        }
+
+        Node &node = mNodes[range.node];
+        for(int axis = 0; axis < 3; axis++)
+        {
+            node.min[axis] = min[axis] - mRadius;
+            node.max[axis] = max[axis] + mRadius;
+        }
+
+        std::size_t count = range.end - range.begin;
+        if(count <= LeafSize)
+        {
+            node.first = (unsigned int)range.begin;
+            node.count = (unsigned int)count;
+            continue;
+        }
+
+        // Median split along the longest axis of the centers
+        int axis = 0;
+        for(int a = 1; a < 3; a++)
+        {
+            if(max[a] - min[a] > max[axis] - min[axis])
+                axis = a;
+        }
+
+        std::size_t middle = range.begin + count / 2;
+        std::nth_element(mItems.begin() + range.begin,
+                         mItems.begin() + middle,
+                         mItems.begin() + range.end,
+                         [&](unsigned int a, unsigned int b) {
+            return mCenters[a][axis] < mCenters[b][axis];
+        });
+
+        unsigned int left = (unsigned int)mNodes.size();
+        node.first = left;
+        node.count = 0;
+
+        // node is invalidated by the growth below
+        mNodes.emplace_back();
+        mNodes.emplace_back();
+        stack.push_back({ left, range.begin, middle });
+        stack.push_back({ left + 1, middle, range.end });
+    }
+}
+
+// Entry distance of a ray into a box grown by margin on every side, or
+// infinity when it misses
+static float rayBoxEntry(const float *min, const float *max, float margin,
+                         const QVector3D &origin, const QVector3D &inverse)
+{
+    float tmin = 0.0f;
+    float tmax = std::numeric_limits<float>::infinity();
+
+    for(int axis = 0; axis < 3; axis++)
+    {
+        float t1 = (min[axis] - margin - origin[axis]) * inverse[axis];
+        float t2 = (max[axis] + margin - origin[axis]) * inverse[axis];
+        if(t1 > t2)
+            std::swap(t1, t2);
+
+        // NaN from 0 * infinity compares false and leaves the bounds as they are
+        tmin = t1 > tmin ? t1 : tmin;
+        tmax = t2 < tmax ? t2 : tmax;
+    }
+
+    return tmin <= tmax ? tmin : std::numeric_limits<float>::infinity();
+}
+
+// Largest distance from a point to a box
+static float farthestDistance(const float *min, const float *max, const QVector3D &point)
+{
+    float d2 = 0.0f;
+    for(int axis = 0; axis < 3; axis++)
+    {
+        float d = std::max(std::abs(min[axis] - point[axis]), std::abs(max[axis] - point[axis]));
+        d2 += d * d;
+    }
+
+    return std::sqrt(d2);
+}
+
+bool MarkerBVH::intersect(const QVector3D &origin,
+                          const QVector3D &direction,
+                          std::size_t &index,
+                          float &distance,
+                          float radiusPerDistance,
+                          const Filter &accept) const
+{
+    if(mNodes.empty())
+        return false;
+
+    QVector3D inverse(1.0f / direction.x(), 1.0f / direction.y(), 1.0f / direction.z());
+    bool growing = radiusPerDistance > 0.0f;
+    float nearest = std::numeric_limits<float>::infinity();
+    bool found = false;
+
+    // Growing spheres are bounded by the radius at the far side of a box
+    auto margin = [&](const Node &node) {
+        return growing ? radiusPerDistance * farthestDistance(node.min, node.max, origin) : 0.0f;
+    };
+
+    unsigned int stack[64];
+    int top = 0;
+    stack[top++] = 0;
+
+    while(top > 0)
+    {
+        const Node &node = mNodes[stack[--top]];
+        if(rayBoxEntry(node.min, node.max, margin(node), origin, inverse) >= nearest)
+            continue;
+
+        if(node.count > 0)
+        {
+            for(unsigned int i = node.first; i < node.first + node.count; i++)
+            {
+                QVector3D toCenter = mCenters[mItems[i]] - origin;
+                float along = QVector3D::dotProduct(toCenter, direction);
+                float radius = growing ? radiusPerDistance * along : mRadius;
+                float radius2 = radius * radius;
+                float d2 = toCenter.lengthSquared() - along * along;
+                if(radius <= 0.0f || d2 > radius2)
+                    continue;
+
+                float t = along - std::sqrt(radius2 - d2);
+                if(t >= 0.0f && t < nearest && (!accept || accept(mItems[i])))
+                {
+                    nearest = t;
+                    index = mItems[i];
+                    found = true;
+                }
+            }
+            continue;
+        }
+
+        // Nearer child last, so it is visited first
+        unsigned int left = node.first, right = node.first + 1;
+        float leftEntry = rayBoxEntry(mNodes[left].min, mNodes[left].max,
+                                      margin(mNodes[left]), origin, inverse);
+        float rightEntry = rayBoxEntry(mNodes[right].min, mNodes[right].max,
+                                       margin(mNodes[right]), origin, inverse);
+        if(leftEntry < rightEntry)
+            std::swap(left, right);
+
+        stack[top++] = left;
+        stack[top++] = right;
+    }
+
+    if(found)
+        distance = nearest;
+
+    return found;
+}
@@ -0,0 +1,76 @@
+//  gamma-viewer-3d - 3d visualization of sessions generated by gamma-analyzer
+//  Copyright (C) 2017  Dag Robole
+//
+//  This program is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef MARKERBVH_H
+#define MARKERBVH_H
+
+#include <cstddef>
+#include <functional>
+#include <vector>
+#include <QVector3D>
+
+// Bounding volume hierarchy over spheres of equal radius, used to find the
+// marker under the mouse with one ray query instead of testing every marker
+class MarkerBVH
+{
+public:
+
+    explicit MarkerBVH(float radius);
+
+    // Builds the tree over the given centers, indices refer into them
+    void build(const std::vector<QVector3D> &centers);
+    void build(const QVector3D *centers, std::size_t count);
+    void clear();
+
+    bool empty() const { return mNodes.empty(); }
+
+    typedef std::function<bool(std::size_t index)> Filter;
+
+    // Finds the nearest sphere hit by the ray at or after its origin.
+    // Direction must be normalized. With radiusPerDistance set, a sphere has
+    // that radius per unit of its distance along the ray instead of the
+    // radius of the tree, as markers of constant size on screen do. Spheres
+    // rejected by accept are passed through.
+    bool intersect(const QVector3D &origin,
+                   const QVector3D &direction,
+                   std::size_t &index,
+                   float &distance,
+                   float radiusPerDistance = 0.0f,
+                   const Filter &accept = Filter()) const;
+
+    static const std::size_t LeafSize = 4;
+
+private:
+
+    struct Node
+    {
+        float min[3];
+        float max[3];
+        // Leaves hold count items from first, inner nodes have count 0 and
+        // their children at first and first + 1
+        unsigned int first;
+        unsigned int count;
+    };
+
+    void buildNodes();
+
+    float mRadius;
+    std::vector<QVector3D> mCenters;
+    std::vector<unsigned int> mItems;
+    std::vector<Node> mNodes;
+};
+
+#endif // MARKERBVH_H
@@ -0,0 +1,75 @@
+//  gamma-viewer-3d - 3d visualization of sessions generated by gamma-analyzer
+//  Copyright (C) 2017  Dag Robole
+//
+//  This program is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "markermaterial.h"
+#include <QUrl>
+#include <Qt3DRender/QGraphicsApiFilter>
+
+MarkerMaterial::MarkerMaterial(Qt3DCore::QNode *parent)
+    :
+      Qt3DRender::QMaterial(parent),
+      mStyle(Spheres),
+      mScreenRadius(new Qt3DRender::QParameter(QStringLiteral("screenRadius"), 0.0f, this)),
+      mEffect(new Qt3DRender::QEffect(this)),
+      mTechnique(new Qt3DRender::QTechnique(this)),
+      mPass(new Qt3DRender::QRenderPass(this)),
+      mProgram(new Qt3DRender::QShaderProgram(this)),
+      mFilterKey(new Qt3DRender::QFilterKey(this))
+{
+    loadShaders();
+    mPass->setShaderProgram(mProgram);
+
+    // Instanced drawing needs OpenGL 3.2
+    mTechnique->graphicsApiFilter()->setApi(Qt3DRender::QGraphicsApiFilter::OpenGL);
+    mTechnique->graphicsApiFilter()->setMajorVersion(3);
+    mTechnique->graphicsApiFilter()->setMinorVersion(2);
+    mTechnique->graphicsApiFilter()->setProfile(Qt3DRender::QGraphicsApiFilter::CoreProfile);
+
+    // Matches the technique filter of the default forward renderer
+    mFilterKey->setName(QStringLiteral("renderingStyle"));
+    mFilterKey->setValue(QStringLiteral("forward"));
+    mTechnique->addFilterKey(mFilterKey);
+
+    mTechnique->addRenderPass(mPass);
+    mEffect->addTechnique(mTechnique);
+    setEffect(mEffect);
+
+    addParameter(mScreenRadius);
+}
+
+void MarkerMaterial::setStyle(Style style)
+{
+    if(style == mStyle)
+        return;
+
+    mStyle = style;
+    loadShaders();
+}
+
+void MarkerMaterial::setScreenRadius(float pixels)
+{
+    mScreenRadius->setValue(pixels);
+}
+
+void MarkerMaterial::loadShaders()
+{
+    QString name = mStyle == Sprites ? QStringLiteral("marker-sprite") : QStringLiteral("marker");
+
+    mProgram->setVertexShaderCode(Qt3DRender::QShaderProgram::loadSource(
+                                      QUrl(QStringLiteral("qrc:/shaders/") + name + QStringLiteral(".vert"))));
+    mProgram->setFragmentShaderCode(Qt3DRender::QShaderProgram::loadSource(
+                                        QUrl(QStringLiteral("qrc:/shaders/") + name + QStringLiteral(".frag"))));
+}
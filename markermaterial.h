@@ -0,0 +1,70 @@
+//  gamma-viewer-3d - 3d visualization of sessions generated by gamma-analyzer
+//  Copyright (C) 2017  Dag Robole
+//
+//  This program is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef MARKERMATERIAL_H
+#define MARKERMATERIAL_H
+
+#include <Qt3DCore/QNode>
+#include <Qt3DRender/QMaterial>
+#include <Qt3DRender/QEffect>
+#include <Qt3DRender/QTechnique>
+#include <Qt3DRender/QRenderPass>
+#include <Qt3DRender/QShaderProgram>
+#include <Qt3DRender/QFilterKey>
+#include <Qt3DRender/QParameter>
+
+// Lit material for instanced spectrum markers. Position, scale and color
+// come from per-instance attributes, see SpectrumMarkerEntity.
+class MarkerMaterial : public Qt3DRender::QMaterial
+{
+    Q_OBJECT
+
+public:
+
+    // Spheres are drawn from a sphere mesh. Sprites are drawn from a quad
+    // facing the camera, shaded as a sphere in the fragment shader.
+    enum Style
+    {
+        Spheres,
+        Sprites
+    };
+
+    explicit MarkerMaterial(Qt3DCore::QNode *parent = nullptr);
+    ~MarkerMaterial() override = default;
+
+    Style style() const { return mStyle; }
+    void setStyle(Style style);
+
+    // Sprite radius in pixels. At zero sprites have the radius of the
+    // instance in world units, like spheres.
+    float screenRadius() const { return mScreenRadius->value().toFloat(); }
+    void setScreenRadius(float pixels);
+
+private:
+
+    Style mStyle;
+    Qt3DRender::QParameter *mScreenRadius;
+
+    Qt3DRender::QEffect *mEffect;
+    Qt3DRender::QTechnique *mTechnique;
+    Qt3DRender::QRenderPass *mPass;
+    Qt3DRender::QShaderProgram *mProgram;
+    Qt3DRender::QFilterKey *mFilterKey;
+
+    void loadShaders();
+};
+
+#endif // MARKERMATERIAL_H
@@ -0,0 +1,276 @@
+//  gamma-viewer-3d - 3d visualization of sessions generated by gamma-analyzer
+//  Copyright (C) 2017  Dag Robole
+//
+//  This program is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "markeroctree.h"
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <utility>
+#include <QVector4D>
+
+constexpr float MarkerOctree::MinHalfSize;
+constexpr float MarkerOctree::RootHalfSize;
+
+static void expandBounds(MarkerOctree::Node &node, const QVector3D &position)
+{
+    for(int axis = 0; axis < 3; axis++)
+    {
+        node.min[axis] = std::min(node.min[axis], position[axis]);
+        node.max[axis] = std::max(node.max[axis], position[axis]);
+    }
+}
+
+MarkerOctree::MarkerOctree()
+    :
+      mRoot(-1)
+{
+}
+
+void MarkerOctree::clear()
+{
+    mPositions.clear();
+    mNodes.clear();
+    mRoot = -1;
+}
+
+void MarkerOctree::markAllDirty()
+{
+    for(auto &node : mNodes)
+        node.dirty = true;
+}
+
+void MarkerOctree::clearDirty()
+{
+    for(auto &node : mNodes)
+        node.dirty = false;
+}
+
+int MarkerOctree::newNode(const float *center, float halfSize, bool leaf)
+{
+    Node node;
+    for(int axis = 0; axis < 3; axis++)
+    {
+        node.center[axis] = center[axis];
+        node.min[axis] = std::numeric_limits<float>::max();
+        node.max[axis] = std::numeric_limits<float>::lowest();
+    }
+    node.halfSize = halfSize;
+    std::fill(node.children, node.children + 8, -1);
+    node.leaf = leaf;
+    node.dirty = true;
+
+    mNodes.push_back(std::move(node));
+    return (int)mNodes.size() - 1;
+}
+
+int MarkerOctree::childNode(int parent, int octant)
+{
+    if(mNodes[parent].children[octant] >= 0)
+        return mNodes[parent].children[octant];
+
+    float halfSize = mNodes[parent].halfSize / 2.0f;
+    float center[3];
+    for(int axis = 0; axis < 3; axis++)
+    {
+        float offset = (octant & (1 << axis)) ? halfSize : -halfSize;
+        center[axis] = mNodes[parent].center[axis] + offset;
+    }
+
+    // Indexed again after, the new node may move the parent in memory
+    int child = newNode(center, halfSize, true);
+    mNodes[parent].children[octant] = child;
+    return child;
+}
+
+int MarkerOctree::octant(const Node &node, const QVector3D &position) const
+{
+    int result = 0;
+    for(int axis = 0; axis < 3; axis++)
+    {
+        if(position[axis] >= node.center[axis])
+            result |= 1 << axis;
+    }
+    return result;
+}
+
+bool MarkerOctree::contains(const Node &node, const QVector3D &position) const
+{
+    for(int axis = 0; axis < 3; axis++)
+    {
+        if(position[axis] < node.center[axis] - node.halfSize ||
+                position[axis] > node.center[axis] + node.halfSize)
+            return false;
+    }
+    return true;
+}
+
+void MarkerOctree::growRoot(const QVector3D &position)
+{
+    // The new root is twice the size, with the old root as one octant on
+    // the side facing away from the position
+    const Node &root = mNodes[mRoot];
+    float center[3];
+    for(int axis = 0; axis < 3; axis++)
+    {
+        float offset = position[axis] >= root.center[axis] ? root.halfSize : -root.halfSize;
+        center[axis] = root.center[axis] + offset;
+    }
+
+    int oldRoot = mRoot;
+    mRoot = newNode(center, mNodes[oldRoot].halfSize * 2.0f, false);
+
+    Node &node = mNodes[mRoot];
+    const Node &old = mNodes[oldRoot];
+    std::copy(old.min, old.min + 3, node.min);
+    std::copy(old.max, old.max + 3, node.max);
+    node.children[octant(node, QVector3D(old.center[0], old.center[1], old.center[2]))] = oldRoot;
+}
+
+void MarkerOctree::insert(const QVector3D &position)
+{
+    unsigned int item = (unsigned int)mPositions.size();
+    mPositions.push_back(position);
+
+    if(mRoot < 0)
+    {
+        float center[3] = { position.x(), position.y(), position.z() };
+        mRoot = newNode(center, RootHalfSize, true);
+    }
+
+    while(!contains(mNodes[mRoot], position))
+        growRoot(position);
+
+    int node = mRoot;
+    while(!mNodes[node].leaf)
+    {
+        expandBounds(mNodes[node], position);
+        node = childNode(node, octant(mNodes[node], position));
+    }
+
+    addToLeaf(node, item);
+}
+
+void MarkerOctree::addToLeaf(int leaf, unsigned int item)
+{
+    Node &node = mNodes[leaf];
+    expandBounds(node, mPositions[item]);
+    node.items.push_back(item);
+    node.dirty = true;
+
+    if(node.items.size() > MaxLeafItems && node.halfSize > MinHalfSize)
+        splitLeaf(leaf);
+}
+
+void MarkerOctree::splitLeaf(int leaf)
+{
+    std::vector<unsigned int> items = std::move(mNodes[leaf].items);
+    mNodes[leaf].items.clear();
+    mNodes[leaf].leaf = false;
+    mNodes[leaf].dirty = true;
+
+    // Children split in turn if everything landed in one of them
+    for(unsigned int item : items)
+    {
+        const QVector3D &position = mPositions[item];
+        addToLeaf(childNode(leaf, octant(mNodes[leaf], position)), item);
+    }
+}
+
+void MarkerOctree::visibleLeaves(const QMatrix4x4 &viewProjection,
+                                 float margin,
+                                 const QVector3D &eye,
+                                 float marginPerDistance,
+                                 std::vector<int> &leaves) const
+{
+    leaves.clear();
+    if(mRoot < 0)
+        return;
+
+    // Frustum planes from the rows of the view projection matrix, with
+    // normals pointing inwards
+    QVector4D planes[6];
+    QVector4D w = viewProjection.row(3);
+    for(int i = 0; i < 3; i++)
+    {
+        planes[2 * i] = w + viewProjection.row(i);
+        planes[2 * i + 1] = w - viewProjection.row(i);
+    }
+
+    // Nodes entirely inside the frustum need no tests below them
+    std::vector<std::pair<int, bool>> stack;
+    stack.emplace_back(mRoot, false);
+
+    while(!stack.empty())
+    {
+        int index = stack.back().first;
+        bool inside = stack.back().second;
+        stack.pop_back();
+
+        const Node &node = mNodes[index];
+
+        if(!inside)
+        {
+            // Children lie within their parent and never reach farther from
+            // the eye, so their grown bounds stay inside a node found inside
+            float nodeMargin = margin;
+            if(marginPerDistance > 0.0f)
+            {
+                QVector3D corner;
+                for(int axis = 0; axis < 3; axis++)
+                    corner[axis] = std::max(std::abs(eye[axis] - node.min[axis]),
+                                            std::abs(eye[axis] - node.max[axis]));
+                nodeMargin += marginPerDistance * corner.length();
+            }
+
+            inside = true;
+            bool outside = false;
+            for(const QVector4D &plane : planes)
+            {
+                // Corners of the box farthest along and against the normal
+                float farthest = plane.w(), nearest = plane.w();
+                for(int axis = 0; axis < 3; axis++)
+                {
+                    float lo = node.min[axis] - nodeMargin, hi = node.max[axis] + nodeMargin;
+                    farthest += plane[axis] * (plane[axis] >= 0.0f ? hi : lo);
+                    nearest += plane[axis] * (plane[axis] >= 0.0f ? lo : hi);
+                }
+
+                if(farthest < 0.0f)
+                {
+                    outside = true;
+                    break;
+                }
+                if(nearest < 0.0f)
+                    inside = false;
+            }
+
+            if(outside)
+                continue;
+        }
+
+        if(node.leaf)
+        {
+            leaves.push_back(index);
+            continue;
+        }
+
+        for(int child : node.children)
+        {
+            if(child >= 0)
+                stack.emplace_back(child, inside);
+        }
+    }
+}
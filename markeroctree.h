@@ -0,0 +1,90 @@
+//  gamma-viewer-3d - 3d visualization of sessions generated by gamma-analyzer
+//  Copyright (C) 2017  Dag Robole
+//
+//  This program is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef MARKEROCTREE_H
+#define MARKEROCTREE_H
+
+#include <cstddef>
+#include <vector>
+#include <QVector3D>
+#include <QMatrix4x4>
+
+// Sparse octree that buckets marker positions into chunks. Each leaf is
+// drawn as one chunk, so whole chunks can be culled against the view
+// frustum. The root grows towards positions outside of it, so the tree
+// needs no bounds up front while a session is loading.
+class MarkerOctree
+{
+public:
+
+    MarkerOctree();
+
+    struct Node
+    {
+        float center[3];
+        float halfSize;
+        // Tight bounds of the positions below this node
+        float min[3];
+        float max[3];
+        int children[8];
+        bool leaf;
+        // Set when the items of a leaf change, or when a leaf is split
+        bool dirty;
+        std::vector<unsigned int> items;
+    };
+
+    // Adds a position, its item index is the number of positions before it
+    void insert(const QVector3D &position);
+    void clear();
+
+    std::size_t count() const { return mPositions.size(); }
+    const std::vector<Node> &nodes() const { return mNodes; }
+
+    void markAllDirty();
+    void clearDirty();
+
+    // Collects the leaves whose bounds, grown by margin, are not entirely
+    // outside the frustum of the given view projection matrix. The margin of
+    // a node grows by marginPerDistance for each unit from eye to its
+    // farthest corner, for markers sized in pixels.
+    void visibleLeaves(const QMatrix4x4 &viewProjection,
+                       float margin,
+                       const QVector3D &eye,
+                       float marginPerDistance,
+                       std::vector<int> &leaves) const;
+
+    // Leaves are split when they hold more items, unless already at the
+    // smallest size
+    static const std::size_t MaxLeafItems = 16384;
+    static constexpr float MinHalfSize = 32.0f;
+    static constexpr float RootHalfSize = 256.0f;
+
+private:
+
+    int newNode(const float *center, float halfSize, bool leaf);
+    int childNode(int parent, int octant);
+    int octant(const Node &node, const QVector3D &position) const;
+    bool contains(const Node &node, const QVector3D &position) const;
+    void growRoot(const QVector3D &position);
+    void addToLeaf(int leaf, unsigned int item);
+    void splitLeaf(int leaf);
+
+    std::vector<QVector3D> mPositions;
+    std::vector<Node> mNodes;
+    int mRoot;
+};
+
+#endif // MARKEROCTREE_H
@@ -15,23 +15,30 @@
 //  along with this program.  If not, see <http://www.gnu.org/licenses/>.
 
 #include "scene.h"
+#include <QRect>
 #include <QVector3D>
+#include <QMatrix4x4>
 #include <Qt3DRender/QCameraLens>
 #include <Qt3DExtras/QForwardRenderer>
 
-Scene::Scene(const QColor &clearColor, QString sessionFileName, QString doserateScriptFileName)
+Scene::Scene(const QColor &clearColor, QStringList doserateScriptFileNames)
     :
-      session(std::make_unique<Gamma::Session>(sessionFileName, doserateScriptFileName)),
+      session(std::make_unique<Gamma::Session>(doserateScriptFileNames)),
       window(new Qt3DExtras::Qt3DWindow),
       root(new Qt3DCore::QEntity),
       camera(nullptr),
       cameraController(new Qt3DExtras::QOrbitCameraController(root)),
       selected(std::make_unique<SelectionEntity>(QVector3D(0.0, 0.0, 0.0), QColor(255, 0, 255), root)),
-      marked(std::make_unique<SelectionEntity>(QVector3D(0.0, 0.0, 0.0), QColor(255, 255, 255), root))
+      marked(std::make_unique<SelectionEntity>(QVector3D(0.0, 0.0, 0.0), QColor(255, 255, 255), root)),
+      markers(new SpectrumMarkerEntity(root)),
+      bvhDirty(false),
+      hasOrigin(false),
+      originX(0.0),
+      originY(0.0),
+      originAltitude(0.0)
 {
     window->defaultFrameGraph()->setClearColor(clearColor);
     window->setIcon(QIcon(":/images/crash.ico"));
-    window->setTitle(session->name());
 
     camera = window->camera();
     camera->lens()->setPerspectiveProjection(45.0f, 16.0f / 9.0f, 0.1f, 10000.0f);
@@ -43,6 +50,27 @@ Scene::Scene(const QColor &clearColor, QString sessionFileName, QString doserate
     cameraController->setLookSpeed(180.0f);
     cameraController->setCamera(camera);
 
+    // Marker chunks are culled by their own octree. The built-in culling
+    // only sees the bounds of the instanced sphere, not of the instances.
+    window->defaultFrameGraph()->setFrustumCullingEnabled(false);
+    markers->setCamera(camera);
+
+    // Sprites are sized in device pixels, their culling margin follows the
+    // window height
+    auto updateViewportHeight = [this]()
+    {
+        markers->setViewportHeight((float)(window->height() * window->devicePixelRatio()));
+    };
+    QObject::connect(window,
+                     &QWindow::heightChanged,
+                     markers,
+                     updateViewportHeight);
+    QObject::connect(window,
+                     &QWindow::screenChanged,
+                     markers,
+                     updateViewportHeight);
+    updateViewportHeight();
+
     selected->setEnabled(false);
     marked->setEnabled(false);
 
@@ -62,6 +90,7 @@ Scene::~Scene()
 
     root->components().clear();
     root->deleteLater();
+    markers->setCamera(nullptr);
     cameraController->setCamera(nullptr);
     cameraController->deleteLater();
     camera = nullptr;
@@ -70,17 +99,90 @@ Scene::~Scene()
     window->deleteLater();
 }
 
-bool Scene::hasChildEntity(Qt3DCore::QEntity *entity) const
+void Scene::setOrigin(double x, double y, double altitude)
 {
-    QObject *e = entity;
+    originX = x;
+    originY = y;
+    originAltitude = altitude;
+    hasOrigin = true;
+}
+
+QVector3D Scene::makeScenePosition(const QVector3D &position, double altitude) const
+{
+    return QVector3D(position.x() - originX,
+                     altitude - originAltitude,
+                     -(position.y() - originY));
+}
+
+bool Scene::pickSpectrum(const QPoint &point, Gamma::SpectrumStoreSize &index) const
+{
+    // Window coordinates have their origin at the top, OpenGL at the bottom
+    QRect viewport(0, 0, window->width(), window->height());
+    QMatrix4x4 view = camera->viewMatrix();
+    QMatrix4x4 projection = camera->projectionMatrix();
+    float x = (float)point.x();
+    float y = (float)(viewport.height() - point.y());
+
+    QVector3D origin = QVector3D(x, y, 0.0f).unproject(view, projection, viewport);
+    QVector3D direction = (QVector3D(x, y, 1.0f).unproject(view, projection, viewport) - origin).normalized();
+
+    // Sprites of constant size on screen grow in world units with their
+    // depth, by the pixel size at that depth along this ray
+    float radiusPerDistance = 0.0f;
+    if(float pixels = markers->screenRadius())
+    {
+        QVector3D forward = (camera->viewCenter() - camera->position()).normalized();
+        float depthPerDistance = QVector3D::dotProduct(direction, forward);
+        float height = (float)(viewport.height() * window->devicePixelRatio());
+        radiusPerDistance = 2.0f * pixels * depthPerDistance / (height * projection(1, 1));
+    }
 
-    while(e)
+    if(bvhDirty)
     {
-        if(e->parent() == root)
-            return true;
-        e = e->parent();
+        std::size_t first = (bvhs.size() - 1) * PickBlockSize;
+        bvhs.back().build(positions.data() + first, positions.size() - first);
+        bvhDirty = false;
     }
 
-    return false;
+    bool found = false;
+    float nearest = 0.0f;
+    for(std::size_t block = 0; block < bvhs.size(); block++)
+    {
+        // Markers left out by culling or level of detail are not picked
+        auto isDrawn = [&](std::size_t hit) {
+            return markers->isDrawn(block * PickBlockSize + hit);
+        };
+
+        std::size_t hit;
+        float distance;
+        if(!bvhs[block].intersect(origin, direction, hit, distance, radiusPerDistance, isDrawn))
+            continue;
+
+        if(!found || distance < nearest)
+        {
+            index = (Gamma::SpectrumStoreSize)(block * PickBlockSize + hit);
+            nearest = distance;
+            found = true;
+        }
+    }
+
+    return found;
+}
+
+void Scene::appendPositions(const std::vector<QVector3D> &newPositions)
+{
+    std::size_t built = positions.size() / PickBlockSize;
+    positions.insert(positions.end(), newPositions.begin(), newPositions.end());
+
+    std::size_t blocks = (positions.size() + PickBlockSize - 1) / PickBlockSize;
+    while(bvhs.size() < blocks)
+        bvhs.emplace_back(SpectrumMarkerEntity::MarkerRadius);
+
+    // Blocks filled by these positions are built once, here
+    std::size_t full = positions.size() / PickBlockSize;
+    for(std::size_t block = built; block < full; block++)
+        bvhs[block].build(positions.data() + block * PickBlockSize, PickBlockSize);
+
+    bvhDirty = full < blocks;
 }
 
@@ -19,8 +19,13 @@
 
 #include "session.h"
 #include "selectionentity.h"
+#include "spectrummarkerentity.h"
+#include "markerbvh.h"
 #include <memory>
+#include <vector>
 #include <QColor>
+#include <QPoint>
+#include <QVector3D>
 #include <Qt3DExtras/Qt3DWindow>
 #include <Qt3DRender/QCamera>
 #include <Qt3DExtras/QOrbitCameraController>
@@ -28,7 +33,7 @@
 
 struct Scene
 {
-    Scene(const QColor &clearColor, QString sessionFileName, QString doserateScriptFileName);
+    Scene(const QColor &clearColor, QStringList doserateScriptFileNames);
     Scene(const Scene &rhs) = delete;
     ~Scene();
 
@@ -40,8 +45,32 @@ struct Scene
     Qt3DRender::QCamera *camera;
     Qt3DExtras::QOrbitCameraController *cameraController;
     std::unique_ptr<SelectionEntity> selected, marked;
+    SpectrumMarkerEntity *markers;
 
-    bool hasChildEntity(Qt3DCore::QEntity *entity) const;
+    // Scene position of every spectrum, by spectrum index
+    std::vector<QVector3D> positions;
+
+    // Picking trees over positions, one per block of PickBlockSize markers
+    // so a growing session never rebuilds the trees of earlier markers. Full
+    // blocks are built as they fill, the last block on the first pick after
+    // it changed.
+    mutable std::vector<MarkerBVH> bvhs;
+    mutable bool bvhDirty;
+    static const std::size_t PickBlockSize = 16384;
+
+    // Scene coordinates are relative to the session center at the time the
+    // first spectra arrived, so entities never move while a session grows
+    bool hasOrigin;
+    double originX, originY, originAltitude;
+
+    void setOrigin(double x, double y, double altitude);
+    QVector3D makeScenePosition(const QVector3D &position, double altitude) const;
+
+    void appendPositions(const std::vector<QVector3D> &newPositions);
+
+    // Finds the marker nearest the camera under a point in the window, at the
+    // size it is drawn with
+    bool pickSpectrum(const QPoint &point, Gamma::SpectrumStoreSize &index) const;
 };
 
 #endif // SCENE_H
@@ -0,0 +1,32 @@
+
+-- Analysis script, run with "Run analysis script on open sessions".
+-- Colors each spectrum by the ratio of counts in a high energy window
+-- to counts in a low energy window.
+
+local low = { 50, 400 }		-- keV
+local high = { 1300, 3000 }	-- keV
+
+local function window (energies, from, to)
+	local first, last = #energies + 1, 0
+	for i = 1, #energies do
+		if energies[i] >= from and energies[i] <= to then
+			if i < first then first = i end
+			last = i
+		end
+	end
+	return first, last
+end
+
+function analyze (session, result)
+	local lowFirst, lowLast = window(session.energies, low[1], low[2])
+	local highFirst, highLast = window(session.energies, high[1], high[2])
+
+	for i = 1, session.count do
+		local channels = session.channels(i)
+		local lowCounts = gamma.sum(channels, lowFirst, math.min(lowLast, #channels))
+		local highCounts = gamma.sum(channels, highFirst, math.min(highLast, #channels))
+		if lowCounts > 0 then
+			result[i] = highCounts / lowCounts
+		end
+	end
+end
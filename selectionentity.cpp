@@ -15,8 +15,6 @@
 //  along with this program.  If not, see <http://www.gnu.org/licenses/>.
 
 #include "selectionentity.h"
-#include "exceptions.h"
-#include "spectrumentity.h"
 #include <QUrl>
 
 SelectionEntity::SelectionEntity(const QVector3D &pos,
@@ -27,7 +25,8 @@ SelectionEntity::SelectionEntity(const QVector3D &pos,
       mMesh(new Qt3DRender::QMesh(this)),
       mMaterial(new Qt3DExtras::QPhongMaterial(this)),
       mTransform(new Qt3DCore::QTransform(this)),
-      mTarget(nullptr)
+      mHasTarget(false),
+      mTarget(0)
 {
     mMesh->setSource(QUrl(QStringLiteral("qrc:/models/arrow.obj")));
     addComponent(mMesh);
@@ -60,16 +59,13 @@ SelectionEntity::~SelectionEntity()
     mTransform->deleteLater();
     mMaterial->deleteLater();
     mMesh->deleteLater();
-    mTarget = nullptr;
 }
 
-void SelectionEntity::setTarget(SpectrumEntity *target)
+void SelectionEntity::setTarget(Gamma::SpectrumStoreSize target, const QVector3D &position)
 {
-    if(!target)
-        throw Exception_InvalidPointer("SelectionEntity::setTarget: target");
-
-    QVector3D position(target->transform()->translation());
-    position.setY(position.y() + 1.6);
-    mTransform->setTranslation(position);
+    QVector3D arrowPosition(position);
+    arrowPosition.setY(arrowPosition.y() + 1.6);
+    mTransform->setTranslation(arrowPosition);
+    mHasTarget = true;
     mTarget = target;
 }
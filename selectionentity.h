@@ -17,14 +17,14 @@
 #ifndef SELECTIONENTITY_H
 #define SELECTIONENTITY_H
 
+#include "spectrumstore.h"
 #include <QColor>
+#include <QVector3D>
 #include <Qt3DCore/QEntity>
 #include <Qt3DRender/QMesh>
 #include <Qt3DExtras/QPhongMaterial>
 #include <Qt3DCore/QTransform>
 
-class SpectrumEntity;
-
 class SelectionEntity : public Qt3DCore::QEntity
 {
     Q_OBJECT
@@ -37,8 +37,10 @@ public:
 
     ~SelectionEntity() override;
 
-    const SpectrumEntity *target() const { return mTarget; }
-    void setTarget(SpectrumEntity *target);
+    // Index of the spectrum pointed at, valid while hasTarget is true
+    bool hasTarget() const { return mHasTarget; }
+    Gamma::SpectrumStoreSize target() const { return mTarget; }
+    void setTarget(Gamma::SpectrumStoreSize target, const QVector3D &position);
 
 private:
 
@@ -46,7 +48,8 @@ private:
     Qt3DExtras::QPhongMaterial *mMaterial;
     Qt3DCore::QTransform *mTransform;
 
-    SpectrumEntity *mTarget;
+    bool mHasTarget;
+    Gamma::SpectrumStoreSize mTarget;
 };
 
 #endif // SELECTIONENTITY_H
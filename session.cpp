@@ -15,12 +15,20 @@
 //  along with this program.  If not, see <http://www.gnu.org/licenses/>.
 
 #include "session.h"
+#include "doseratekernel.h"
+#include "sessioncache.h"
+#include "sessionreader.h"
+#include "luachunkcache.h"
 #include <exception>
+#include <algorithm>
 #include <cmath>
+#include <limits>
 #include <QString>
 #include <QDir>
 #include <QFile>
 #include <QFileInfo>
+#include <QCryptographicHash>
+#include <QElapsedTimer>
 #include <QJsonDocument>
 #include <QJsonObject>
 #include <QDebug>
@@ -28,36 +36,45 @@
 namespace Gamma
 {
 
-Session::Session(QString sessionFileName, QString doserateScriptFileName)
-    :
-      L(luaL_newstate()),
-      mScriptLoaded(false),
-      mLivetime(0.0),
-      mMinDoserate(0.0),
-      mMaxDoserate(0.0),
-      mMinX(0.0),
-      mMaxX(0.0),
-      mMinY(0.0),
-      mMaxY(0.0),
-      mMinZ(0.0),
-      mMaxZ(0.0),
-      mMinLatitude(0.0),
-      mMaxLatitude(0.0),
-      mMinLongitude(0.0),
-      mMaxLongitude(0.0),
-      mMinAltitude(0.0),
-      mMaxAltitude(0.0),
-      mLogarithmicColorScale(true)
-{
-    if(!L.get())
-        throw Exception_UnableToCreateLuaState("Session::Session");
+static std::atomic_int sessionCounter(0);
 
-    luaL_openlibs(L.get());
+// Cache key of sessions using the compiled plugin of their detector. The
+// detector is not known when the session cache is opened, so the key covers
+// every registered plugin.
+static const QString nativeKeyPrefix = QStringLiteral("native|");
 
-    if(!doserateScriptFileName.isEmpty() && QFile::exists(doserateScriptFileName))
-        loadDoserateScript(doserateScriptFileName);
+static QString nativeScriptKey()
+{
+    return nativeKeyPrefix + doseratePluginsKey();
+}
 
-    loadDatabaseFile(sessionFileName);
+static bool isNativeScriptKey(const QString &key)
+{
+    return key.startsWith(nativeKeyPrefix);
+}
+
+Session::Session(QStringList doserateScriptFileNames)
+    :
+      mConnectionName(QString("Session%1").arg(++sessionCounter)),
+      mLazyChannels(false),
+      mChannelCache(ChannelCacheSize),
+      mLastSessionIndex(std::numeric_limits<int>::min()),
+      mActiveModel(0),
+      mScriptKey(nativeScriptKey()),
+      mLivetime(0.0),
+      mHalfX(0.0),
+      mHalfY(0.0),
+      mHalfZ(0.0),
+      mLogarithmicColorScale(true),
+      mMinColorValue(0.0),
+      mMaxColorValue(0.0)
+{
+    // Scripts are loaded by readDatabaseFile, on the loader thread
+    for(auto &fileName : doserateScriptFileNames)
+    {
+        if(!fileName.isEmpty() && QFile::exists(fileName))
+            mPendingScriptFileNames << fileName;
+    }
 }
 
 Session::~Session()
@@ -72,194 +89,799 @@ Session::~Session()
     }
 }
 
-const SpectrumList &Session::spectrumList() const
+Spectrum Session::spectrum(SpectrumStoreSize index) const
 {
-    return mSpectrumList;
+    if(index >= mSpectra.size())
+        throw Exception_IndexOutOfBounds("Session::spectrum");
+
+    return Spectrum(mSpectra, index);
 }
 
-const Spectrum &Session::spectrum(SpectrumListSize index) const
+std::vector<int> Session::spectrumChannels(SpectrumStoreSize index)
 {
-    if(index >= mSpectrumList.size())
-        throw Exception_IndexOutOfBounds("Session::spectrum");
+    if(index >= mSpectra.size())
+        throw Exception_IndexOutOfBounds("Session::spectrumChannels");
+
+    if(!mLazyChannels)
+        return std::vector<int>(mSpectra.channels(index),
+                                mSpectra.channels(index) + mSpectra.numChannels(index));
+
+    int sessionIndex = mSpectra.sessionIndices()[index];
+    if(auto channels = mChannelCache.find(sessionIndex))
+        return *channels;
+
+    std::vector<int> channels;
+    if(!reader().readChannels(sessionIndex, channels))
+        throw Exception_SpectrumNotFound(QString::number(sessionIndex));
 
-    return *mSpectrumList[index];
+    return mChannelCache.insert(sessionIndex, std::move(channels));
 }
 
-void Session::loadDoserateScript(QString scriptFileName)
+SpectrumStoreSize Session::readNewSpectra()
 {
-    if(luaL_dofile(L.get(), scriptFileName.toStdString().c_str()))
-        throw Exception_LoadDoserateScriptFailed(scriptFileName);
-    mScriptLoaded = true;
+    if(mDatabaseFileName.isEmpty())
+        return 0;
+
+    SessionReader &newSpectra = reader();
+
+    SpectrumStore chunk;
+    chunk.setModelCount(mModels.size());
+    try
+    {
+        newSpectra.beginSpectraAfter(mLastSessionIndex);
+        while(newSpectra.readSpectrum(chunk)) {}
+    }
+    catch(const SessionReader::Exception_DatabaseBusy &)
+    {
+        // The writer holds the lock, the rest is read on a later call
+    }
+
+    if(chunk.empty())
+        return 0;
+
+    calculateDoserates(chunk);
+    if(mLazyChannels)
+        chunk.dropChannels();
+
+    auto count = chunk.size();
+    appendSpectra(std::move(chunk));
+
+    return count;
 }
 
-void Session::loadDatabaseFile(QString databaseFileName)
+SessionReader &Session::reader()
+{
+    if(!mReader)
+        mReader = makeSessionReader(mDatabaseFileName, connectionName("GUI"), InteractiveBusyTimeout);
+    return *mReader;
+}
+
+std::unique_ptr<SessionReader> Session::makeReader(QString purpose) const
+{
+    return makeSessionReader(mDatabaseFileName, connectionName(purpose), LoaderBusyTimeout);
+}
+
+QString Session::connectionName(QString purpose) const
+{
+    // Loads and on demand reads of a session may overlap
+    return mConnectionName + purpose;
+}
+
+struct Session::DoserateUpdate
 {
-    QSqlDatabase db;
+    std::vector<DoseModel> models;
+    std::unique_ptr<StackedWeights> stackedWeights;
+    QString scriptKey;
+    SpectrumStoreSize spectrumCount;
+    std::vector<double> modelDoserates;
+};
+
+std::shared_ptr<Session::DoserateUpdate> Session::calculateDoserateUpdate(
+        const QStringList &scriptFileNames,
+        const std::atomic_bool &cancelled,
+        const ProgressHandler &progress) const
+{
+    auto update = std::make_shared<DoserateUpdate>();
+
+    QStringList keys;
+    for(auto &fileName : scriptFileNames)
+    {
+        update->models.push_back(loadDoseModel(fileName));
+        keys << update->models.back().key;
+    }
 
-    if (QSqlDatabase::contains())
-        db = QSqlDatabase::database(QLatin1String(QSqlDatabase::defaultConnection), false);
+    if(keys.isEmpty())
+    {
+        update->scriptKey = nativeScriptKey();
+        DoseModel model;
+        if(makeNativeDoseModel(model))
+            update->models.push_back(std::move(model));
+    }
     else
-        db = QSqlDatabase::addDatabase("QSQLITE");
+        update->scriptKey = keys.join(';');
 
-    db.setDatabaseName(databaseFileName);
-    if(!db.open())
-        throw Exception_UnableToOpenDatabase(databaseFileName);
+    updateGEWeights(update->models, update->stackedWeights);
 
-    clear();
+    const SpectrumStoreSize chunkSize = 1000;
+    std::size_t modelCount = update->models.size();
+    SpectrumStoreSize total = mSpectra.size();
+    update->spectrumCount = total;
+    update->modelDoserates.assign(total * modelCount, 0.0);
 
-    QSqlQuery sessionQuery("SELECT * FROM session");
-    sessionQuery.next();
-    loadSessionQuery(sessionQuery);
+    if(!modelCount)
+        return update;
 
-    bool firstIteration = true;
-    QSqlQuery spectrumQuery("SELECT * FROM spectrum");
-    while(spectrumQuery.next())
+    if(!mLazyChannels)
     {
-        auto spec = std::make_unique<Spectrum>(spectrumQuery);
+        for(SpectrumStoreSize first = 0; first < total; first += chunkSize)
+        {
+            if(cancelled)
+                return nullptr;
+
+            SpectrumStoreSize last = std::min(first + chunkSize, total);
+            calculateDoserates(mSpectra, first, last,
+                               update->models,
+                               update->stackedWeights.get(),
+                               update->modelDoserates.data() + first * modelCount);
+            progress((int)last, (int)total);
+        }
+
+        return update;
+    }
+
+    // Channels are not kept in memory, so they are streamed once more
+    auto reader = makeReader("Apply");
+    reader->beginSpectra();
 
-        if(mScriptLoaded)
-            spec->calculateDoserate(mDetector, L.get());
+    const auto &sessionIndices = mSpectra.sessionIndices();
+    SpectrumStoreSize first = 0;
+    SpectrumStore chunk;
 
-        if(firstIteration)
+    auto flushChunk = [&]() {
+        SpectrumStoreSize count = std::min(chunk.size(), total - first);
+        for(SpectrumStoreSize i = 0; i < count; i++)
         {
-            firstIteration = false;
-            mMinDoserate = mMaxDoserate = spec->doserate();
-            mMinX = mMaxX = spec->position.x();
-            mMinY = mMaxY = spec->position.y();
-            mMinZ = mMaxZ = spec->position.z();
-            mMinLatitude = mMaxLatitude = spec->coordinate.latitude();
-            mMinLongitude = mMaxLongitude = spec->coordinate.longitude();
-            mMinAltitude = mMaxAltitude = spec->coordinate.altitude();
+            if(chunk.sessionIndices()[i] != sessionIndices[first + i])
+                throw Exception_SpectrumNotFound(QString::number(sessionIndices[first + i]));
         }
+
+        calculateDoserates(chunk, 0, count,
+                           update->models,
+                           update->stackedWeights.get(),
+                           update->modelDoserates.data() + first * modelCount);
+        first += count;
+        chunk.clear();
+        progress((int)first, (int)total);
+    };
+
+    while(first + chunk.size() < total && reader->readSpectrum(chunk))
+    {
+        if(cancelled)
+            return nullptr;
+
+        if(chunk.size() >= chunkSize)
+            flushChunk();
+    }
+
+    if(!chunk.empty())
+        flushChunk();
+
+    // Spectra missing from the database would be left without doserates
+    if(first < total)
+        throw Exception_SpectrumNotFound(QString::number(sessionIndices[first]));
+
+    return update;
+}
+
+void Session::commitDoserateUpdate(DoserateUpdate &update)
+{
+    if(update.spectrumCount != mSpectra.size())
+        throw Exception_IndexOutOfBounds("Session::commitDoserateUpdate");
+
+    mModels = std::move(update.models);
+    mStackedWeights = std::move(update.stackedWeights);
+    mScriptKey = update.scriptKey;
+    mActiveModel = 0;
+
+    mSpectra.setModelCount(mModels.size());
+    mSpectra.modelDoserates() = std::move(update.modelDoserates);
+    mSpectra.selectModel(mActiveModel);
+
+    updateDoserateBounds();
+}
+
+void Session::setActiveDoseModel(std::size_t model)
+{
+    // Every model has its doserates already, switching is only a copy
+    mSpectra.selectModel(model);
+    mActiveModel = model;
+
+    updateDoserateBounds();
+}
+
+QStringList Session::doseModelNames() const
+{
+    QStringList names;
+    for(auto &model : mModels)
+        names << QFileInfo(model.fileName).completeBaseName();
+
+    return names;
+}
+
+void Session::updateDoserateBounds()
+{
+    // Positions are unchanged, only the doserate range has to be redone
+    const auto &doserates = mSpectra.doserates();
+    const auto &positions = mSpectra.positions();
+    const auto &latitudes = mSpectra.latitudes();
+    const auto &longitudes = mSpectra.longitudes();
+    const auto &altitudes = mSpectra.altitudes();
+
+    mBounds.clear();
+    for(SpectrumStoreSize i = 0; i < mSpectra.size(); i++)
+        mBounds.include(doserates[i], positions[i],
+                        latitudes[i], longitudes[i], altitudes[i]);
+}
+
+void Session::updateGEWeights()
+{
+    if(isNativeScriptKey(mScriptKey))
+        loadNativeDoseModel();
+
+    updateGEWeights(mModels, mStackedWeights);
+}
+
+void Session::updateGEWeights(std::vector<DoseModel> &models,
+                              std::unique_ptr<StackedWeights> &stackedWeights) const
+{
+    std::vector<const GEWeightTable*> tables;
+
+    for(auto &model : models)
+    {
+        if(model.plugin)
+            model.weights = GEWeightTable::lookup(mDetector, model.key, *model.plugin);
+        else if(model.cacheable)
+            model.weights = GEWeightTable::lookup(mDetector, model.key, model.L.get());
         else
+            model.weights.reset();
+
+        tables.push_back(model.weights.get());
+    }
+
+    // A single model uses the plain kernel
+    if(models.size() > 1)
+        stackedWeights = std::make_unique<StackedWeights>(tables);
+    else
+        stackedWeights.reset();
+}
+
+void Session::calculateDoserates(SpectrumStore &chunk)
+{
+    if(mModels.empty())
+        return;
+
+    calculateDoserates(chunk, 0, chunk.size(),
+                       mModels,
+                       mStackedWeights.get(),
+                       chunk.modelDoserates().data());
+
+    chunk.selectModel(mActiveModel);
+}
+
+void Session::calculateDoserates(const SpectrumStore &spectra,
+                                 SpectrumStoreSize begin,
+                                 SpectrumStoreSize end,
+                                 std::vector<DoseModel> &models,
+                                 const StackedWeights *stackedWeights,
+                                 double *doserates) const
+{
+    if(models.empty() || begin >= end)
+        return;
+
+    // Offsets index the whole channel buffer, so a range needs no copy
+    const int *channels = spectra.channelData().data();
+    const std::size_t *offsets = spectra.channelOffsets().data() + begin;
+    const int *livetimes = spectra.livetimes().data() + begin;
+    std::size_t count = end - begin;
+
+    // One sweep over the channels covers every tabulated model
+    if(stackedWeights)
+        Gamma::calculateDoserates(channels,
+                                  offsets,
+                                  livetimes,
+                                  count,
+                                  *stackedWeights,
+                                  doserates);
+    else if(models.front().weights)
+        Gamma::calculateDoserates(channels,
+                                  offsets,
+                                  livetimes,
+                                  count,
+                                  *models.front().weights,
+                                  doserates);
+
+    for(std::size_t model = 0; model < models.size(); model++)
+    {
+        if(models[model].pool)
+            calculateScriptedDoserates(spectra, begin, end, models, model, doserates);
+    }
+}
+
+void Session::calculateScriptedDoserates(const SpectrumStore &spectra,
+                                         SpectrumStoreSize begin,
+                                         SpectrumStoreSize end,
+                                         std::vector<DoseModel> &models,
+                                         std::size_t model,
+                                         double *doserates) const
+{
+    int startChannel, endChannel;
+    GEWeightTable::channelWindow(mDetector, startChannel, endChannel);
+
+    const EnergyList &energies = mDetector.energyTable();
+    const std::vector<int> &livetimes = spectra.livetimes();
+    std::size_t modelCount = models.size();
+
+    // Batch scripts get the energies of the whole window in MeV at once
+    std::vector<double> window;
+    for(int j = startChannel; j < endChannel; j++)
+        window.push_back(energies[j] / 1000.0);
+
+    // Every worker writes the doserates of its own range of spectra
+    models[model].pool->run(end - begin, [&](lua_State *state, std::size_t first, std::size_t last) {
+        LuaBudget budget(state);
+        bool batch = hasGEValueBatch(state);
+        std::vector<double> weights;
+
+        for(std::size_t row = first; row < last; row++)
+        {
+            SpectrumStoreSize i = begin + row;
+            const int *channels = spectra.channels(i);
+            int endChan = std::min(endChannel, (int)spectra.numChannels(i));
+
+            double sum = 0.0;
+            if(batch && endChan > startChannel)
+            {
+                std::size_t count = (std::size_t)(endChan - startChannel);
+                weights.assign(count, 0.0);
+                luaGEValueBatch(state, window.data(), weights.data(), count,
+                                channels + startChannel);
+
+                for(int j = startChannel; j < endChan; j++)
+                {
+                    if (energies[j] >= 0.05) // Energies below 0.05 are invalid
+                        sum += weights[j - startChannel] * channels[j];
+                }
+            }
+            else
+            {
+                for(int j = startChannel; j < endChan; j++)
+                {
+                    double E = energies[j];
+                    if (E < 0.05) // Energies below 0.05 are invalid
+                        continue;
+                    sum += luaGEValue(state, E / 1000.0) * channels[j];
+                }
+            }
+
+            double sec = (double)livetimes[i] / 1000000.0;
+            doserates[row * modelCount + model] = sum / sec * 60.0;
+        }
+    });
+}
+
+Session::DoseModel Session::loadDoseModel(QString scriptFileName) const
+{
+    QFile scriptFile(scriptFileName);
+    if(!scriptFile.open(QIODevice::ReadOnly))
+        throw Exception_LoadDoserateScriptFailed(scriptFileName + ": " + scriptFile.errorString());
+
+    DoseModel model;
+    model.fileName = scriptFileName;
+
+    model.L = newLuaState();
+    if(!model.L)
+        throw Exception_UnableToCreateLuaState("Session::loadDoseModel");
+
+    if(!runLuaScript(model.L.get(), scriptFileName))
+        throw Exception_LoadDoserateScriptFailed(scriptFileName + ": " + lua_tostring(model.L.get(), -1));
+
+    // Weight tables are shared between sessions using the same script
+    model.key = scriptFileName + '|' + QString::fromLatin1(
+                QCryptographicHash::hash(scriptFile.readAll(),
+                                         QCryptographicHash::Sha1).toHex());
+
+    // Scripts that can not be tabulated run on one state per core, shared
+    // by the sessions using the same script
+    model.cacheable = isGEValueCacheable(model.L.get());
+    if(!model.cacheable)
+        model.pool = LuaStatePool::shared(model.key, scriptFileName);
+
+    return model;
+}
+
+void Session::loadDoserateScripts(const QStringList &scriptFileNames)
+{
+    std::vector<DoseModel> models;
+    QStringList keys;
+
+    for(auto &fileName : scriptFileNames)
+    {
+        models.push_back(loadDoseModel(fileName));
+        keys << models.back().key;
+    }
+
+    mModels = std::move(models);
+    mScriptKey = keys.isEmpty() ? nativeScriptKey() : keys.join(';');
+    mStackedWeights.reset();
+    mActiveModel = 0;
+}
+
+bool Session::makeNativeDoseModel(DoseModel &model) const
+{
+    DoseratePluginPointer plugin = findDoseratePlugin(mDetector);
+    if(!plugin)
+        return false;
+
+    model.fileName = plugin->name();
+    model.key = nativeKeyPrefix + plugin->name() + '@' + plugin->fingerprint();
+    model.cacheable = true;
+    model.plugin = plugin;
+    return true;
+}
+
+void Session::loadNativeDoseModel()
+{
+    // Detectors without a compiled plugin get no doserates until a script
+    // is loaded
+    mModels.clear();
+    mStackedWeights.reset();
+    mActiveModel = 0;
+
+    DoseModel model;
+    if(makeNativeDoseModel(model))
+        mModels.push_back(std::move(model));
+}
+
+LuaArena::Statistics Session::luaAllocStatistics() const
+{
+    LuaArena::Statistics total;
+
+    for(auto &model : mModels)
+    {
+        if(model.L)
         {
-            if(mMinDoserate > spec->doserate())
-                mMinDoserate = spec->doserate();
-            if(mMaxDoserate < spec->doserate())
-                mMaxDoserate = spec->doserate();
-
-            if(mMinX > spec->position.x())
-                mMinX = spec->position.x();
-            if(mMaxX < spec->position.x())
-                mMaxX = spec->position.x();
-
-            if(mMinY > spec->position.y())
-                mMinY = spec->position.y();
-            if(mMaxY < spec->position.y())
-                mMaxY = spec->position.y();
-
-            if(mMinZ > spec->position.z())
-                mMinZ = spec->position.z();
-            if(mMaxZ < spec->position.z())
-                mMaxZ = spec->position.z();
-
-            if(mMinLatitude > spec->coordinate.latitude())
-                mMinLatitude = spec->coordinate.latitude();
-            if(mMaxLatitude < spec->coordinate.latitude())
-                mMaxLatitude = spec->coordinate.latitude();
-
-            if(mMinLongitude > spec->coordinate.longitude())
-                mMinLongitude = spec->coordinate.longitude();
-            if(mMaxLongitude < spec->coordinate.longitude())
-                mMaxLongitude = spec->coordinate.longitude();
-
-            if(mMinAltitude > spec->coordinate.altitude())
-                mMinAltitude = spec->coordinate.altitude();
-            if(mMaxAltitude < spec->coordinate.altitude())
-                mMaxAltitude = spec->coordinate.altitude();
+            if(LuaArena *arena = luaArena(model.L.get()))
+                total += arena->statistics();
         }
 
-        mSpectrumList.emplace_back(std::move(spec));
+        if(model.pool)
+            total += model.pool->allocStatistics();
+    }
+
+    return total;
+}
+
+qint64 Session::luaScriptTime() const
+{
+    qint64 total = 0;
+
+    for(auto &model : mModels)
+    {
+        if(model.L)
+            total += Gamma::luaScriptTime(model.L.get());
+
+        if(model.pool)
+            total += model.pool->scriptTime();
+    }
+
+    return total;
+}
+
+void Session::resetLuaStatistics()
+{
+    for(auto &model : mModels)
+    {
+        if(model.L)
+        {
+            if(LuaArena *arena = luaArena(model.L.get()))
+                arena->resetStatistics();
+            resetLuaScriptTime(model.L.get());
+        }
+
+        if(model.pool)
+            model.pool->resetStatistics();
+    }
+}
+
+void Session::loadDatabaseFile(QString databaseFileName)
+{
+    clear();
+
+    std::atomic_bool cancelled(false);
+
+    readDatabaseFile(databaseFileName,
+                     cancelled,
+                     1000,
+                     [this](SpectrumStore &&chunk, int, int) {
+        appendSpectra(std::move(chunk));
+    });
+}
+
+bool Session::readDatabaseFile(QString databaseFileName,
+                               const std::atomic_bool &cancelled,
+                               SpectrumStoreSize chunkSize,
+                               const SpectrumChunkHandler &handler)
+{
+    mDatabaseFileName = databaseFileName;
+    mLoadStatistics = LoadStatistics();
+
+    // The script key is part of the session cache key
+    if(!mPendingScriptFileNames.isEmpty())
+    {
+        loadDoserateScripts(mPendingScriptFileNames);
+        mPendingScriptFileNames.clear();
+    }
+
+    QElapsedTimer totalTimer;
+    totalTimer.start();
+
+    SessionCache cache(databaseFileName, mScriptKey);
+    if(cache.open())
+    {
+        mLoadStatistics.source = "cache";
+        bool done = readSessionCache(cache, cancelled, handler);
+        mLoadStatistics.totalTime = totalTimer.nsecsElapsed();
+        mLoadStatistics.readTime = mLoadStatistics.totalTime;
+        return done;
+    }
+
+    // The reader must be created, used and destroyed by the calling thread
+    auto reader = makeSessionReader(databaseFileName, connectionName("Load"), LoaderBusyTimeout);
+    mLoadStatistics.source = reader->backendName();
+
+    QString name, comment;
+    double livetime = 0.0;
+    QByteArray detectorData;
+    reader->readSession(name, comment, livetime, detectorData);
+    loadSessionInfo(name, comment, livetime, detectorData);
+
+    cache.beginWrite(mName, mComment, mLivetime, mDetectorData);
+
+    resetLuaStatistics();
+    updateGEWeights();
+
+    int total = reader->spectrumCount();
+    int loaded = 0;
+    std::size_t chunkChannels = chunkSize * (std::size_t)std::max(mDetector.numChannels(), 0);
+    SpectrumStore chunk;
+    chunk.setModelCount(mModels.size());
+    chunk.reserve(chunkSize, chunkChannels);
+
+    QElapsedTimer timer;
+
+    auto flushChunk = [&]() {
+        timer.start();
+        calculateDoserates(chunk);
+        mLoadStatistics.doserateTime += timer.nsecsElapsed();
+
+        timer.start();
+        cache.writeChunk(chunk);
+        mLoadStatistics.cacheTime += timer.nsecsElapsed();
+
+        if(mLazyChannels)
+            chunk.dropChannels();
+
+        handler(std::move(chunk), loaded, total);
+        chunk.clear();
+        chunk.reserve(chunkSize, chunkChannels);
+    };
+
+    reader->beginSpectra();
+    while(reader->readSpectrum(chunk))
+    {
+        if(cancelled)
+            return false;
+
+        loaded++;
+
+        if(chunk.size() >= chunkSize)
+            flushChunk();
     }
 
-    db.close();
+    if(!chunk.empty())
+        flushChunk();
+
+    timer.start();
+    cache.commit();
+    mLoadStatistics.cacheTime += timer.nsecsElapsed();
 
-    mHalfX = (mMaxX - mMinX) / 2.0;
-    mHalfY = (mMaxY - mMinY) / 2.0;
-    mHalfZ = (mMaxZ - mMinZ) / 2.0;
+    auto luaStatistics = luaAllocStatistics();
+    mLoadStatistics.luaAllocations = (qint64)luaStatistics.allocations;
+    mLoadStatistics.luaPeakBytes = (qint64)luaStatistics.peakBytes;
+    mLoadStatistics.luaScriptTime = luaScriptTime();
 
-    centerPosition.setX(mMinX + mHalfX);
-    centerPosition.setY(mMinY + mHalfY);
-    centerPosition.setZ(mMinZ + mHalfZ);
+    mLoadStatistics.spectrumCount = loaded;
+    mLoadStatistics.totalTime = totalTimer.nsecsElapsed();
+    mLoadStatistics.readTime = mLoadStatistics.totalTime
+            - mLoadStatistics.doserateTime - mLoadStatistics.cacheTime;
+
+    return true;
+}
+
+bool Session::readSessionCache(SessionCache &cache,
+                               const std::atomic_bool &cancelled,
+                               const SpectrumChunkHandler &handler)
+{
+    loadSessionInfo(cache.name(),
+                    cache.comment(),
+                    cache.livetime(),
+                    cache.detectorData());
+
+    // Bounds are known up front, so the scene is centered from the start
+    mBounds = cache.bounds();
+
+    // Doserates come from the cache, weights are for spectra read later
+    updateGEWeights();
+
+    int total = (int)cache.spectrumCount();
+    int loaded = 0;
+    SpectrumStore chunk;
+
+    while(cache.readChunk(chunk, !mLazyChannels))
+    {
+        if(cancelled)
+            return false;
+
+        loaded += (int)chunk.size();
+        mLoadStatistics.spectrumCount = loaded;
+        handler(std::move(chunk), loaded, total);
+        chunk.clear();
+    }
+
+    if(cache.failed())
+    {
+        cache.remove();
+        throw Exception_UnableToLoadFile(cache.fileName());
+    }
+
+    return true;
+}
+
+void Session::appendSpectra(SpectrumStore &&spectra)
+{
+    if(spectra.empty())
+        return;
+
+    const auto &doserates = spectra.doserates();
+    const auto &positions = spectra.positions();
+    const auto &latitudes = spectra.latitudes();
+    const auto &longitudes = spectra.longitudes();
+    const auto &altitudes = spectra.altitudes();
+
+    const auto &sessionIndices = spectra.sessionIndices();
+
+    // The column does not cover the new spectra
+    clearColorColumn();
+
+    if(mActiveModel < spectra.modelCount())
+        spectra.selectModel(mActiveModel);
+
+    for(SpectrumStoreSize i = 0; i < spectra.size(); i++)
+    {
+        mBounds.include(doserates[i], positions[i],
+                        latitudes[i], longitudes[i], altitudes[i]);
+        mLastSessionIndex = std::max(mLastSessionIndex, sessionIndices[i]);
+    }
+
+    // The first chunk becomes the store, later chunks are copied in
+    if(mSpectra.empty())
+        mSpectra = std::move(spectra);
+    else
+        mSpectra.append(spectra);
+
+    updateCenter();
+}
+
+void Session::updateCenter()
+{
+    mHalfX = (mBounds.maxX - mBounds.minX) / 2.0;
+    mHalfY = (mBounds.maxY - mBounds.minY) / 2.0;
+    mHalfZ = (mBounds.maxZ - mBounds.minZ) / 2.0;
+
+    centerPosition.setX(mBounds.minX + mHalfX);
+    centerPosition.setY(mBounds.minY + mHalfY);
+    centerPosition.setZ(mBounds.minZ + mHalfZ);
     centerCoordinate = Geo::cartesianToGeodetic(centerPosition);
 
     northCoordinate = centerCoordinate.atDistanceAndAzimuth(50.0, 0.0);
     northPosition = Geo::geodeticToCartesian(northCoordinate);
 }
 
-void Session::loadSessionQuery(QSqlQuery &query)
+void Session::loadSessionInfo(QString name,
+                              QString comment,
+                              double livetime,
+                              QByteArray detectorData)
 {
-    int idName = query.record().indexOf("name");
-    int idComment = query.record().indexOf("comment");
-    int idLivetime = query.record().indexOf("livetime");
-    int idDetectorData = query.record().indexOf("detector_data");
+    mName = name;
+    mComment = comment;
+    mLivetime = livetime;
+    mDetectorData = detectorData;
 
-    mName = query.value(idName).toString();
-    mComment = query.value(idComment).toString();
-    mLivetime = query.value(idLivetime).toInt();
-
-    QJsonDocument doc = QJsonDocument::fromJson(query.value(idDetectorData).toString().toUtf8());
+    QJsonDocument doc = QJsonDocument::fromJson(mDetectorData);
     mDetector.loadJson(doc.object());
 }
 
 void Session::clear()
 {
-    mSpectrumList.clear();
+    mSpectra.clear();
+    mChannelCache.clear();
+    clearColorColumn();
+    mReader.reset();
+    mLastSessionIndex = std::numeric_limits<int>::min();
 
     mName = "";
-    mLivetime = mMinDoserate = mMaxDoserate = 0.0;
-    mMinX = mMaxX = mMinY = mMaxY = mMinZ = mMaxZ = 0.0;
-    mMinLatitude = mMaxLatitude = 0.0;
-    mMinLongitude = mMaxLongitude = 0.0;
-    mMinAltitude = mMaxAltitude = 0.0;
+    mLivetime = 0.0;
+    mBounds.clear();
 }
 
-QColor Session::makeDoserateColor(double doserate) const
+void Session::makeDoserateColors(std::vector<ColorRGBA8> &colors, SpectrumStoreSize first) const
 {
-    if(doserate == 0.0)
-        return QColor(0, 255, 0);
+    first = std::min(first, mSpectra.size());
+    colors.resize(mSpectra.size() - first);
 
-    QColor color;
-    auto minVal = mMinDoserate;
-    auto maxVal = mMaxDoserate;
+    const ColorMap &colorMap = ColorMap::instance();
 
-    if(mLogarithmicColorScale)
+    // Analysis columns may be negative, they are always scaled linearly
+    if(!mColorColumn.empty())
     {
-        minVal = std::log(minVal);
-        maxVal = std::log(maxVal);
-        doserate = std::log(doserate);
+        colorMap.map(mColorColumn.data() + first, colors.size(),
+                     mMinColorValue, mMaxColorValue,
+                     ColorMap::Linear, false, colors.data());
+        return;
     }
 
-    auto f = (doserate - minVal) / (maxVal - minVal);
-    auto a = (1.0 - f) / 0.25;	// invert and group
-    auto x = std::floor(a);	// the integer part
-    auto y = std::floor(255.0 * (a - x)); // the fractional part from 0 to 255
+    double minValue = mBounds.minDoserate;
+    double maxValue = mBounds.maxDoserate;
 
-    switch((int)x)
+    // Zero doserates have no colour on the ramp, and no logarithm either
+    if(mLogarithmicColorScale && minValue <= 0.0)
     {
-    case 0:
-        color.setRgb(255, y, 0);
-        break;
-    case 1:
-        color.setRgb(255 - y, 255, 0);
-        break;
-    case 2:
-        color.setRgb(0, 255, y);
-        break;
-    case 3:
-        color.setRgb(0, 255 - y, 255);
-        break;
-    case 4:
-        color.setRgb(0, 0, 255);
-        break;
+        minValue = maxValue;
+        for(double doserate : mSpectra.doserates())
+        {
+            if(doserate > 0.0 && doserate < minValue)
+                minValue = doserate;
+        }
     }
 
-    return color;
+    colorMap.map(mSpectra.doserates().data() + first, colors.size(),
+                 minValue, maxValue,
+                 mLogarithmicColorScale ? ColorMap::Logarithmic : ColorMap::Linear,
+                 true, colors.data());
+}
+
+void Session::setColorColumn(QString name, std::vector<double> values)
+{
+    if(values.size() != mSpectra.size())
+        throw Exception_IndexOutOfBounds("Session::setColorColumn");
+
+    mColorColumnName = name;
+    mColorColumn = std::move(values);
+    mMinColorValue = mMaxColorValue = 0.0;
+
+    if(!mColorColumn.empty())
+    {
+        auto range = std::minmax_element(mColorColumn.begin(), mColorColumn.end());
+        mMinColorValue = *range.first;
+        mMaxColorValue = *range.second;
+    }
 }
 
-QColor Session::makeDoserateColor(const Spectrum &spec) const
+void Session::clearColorColumn()
 {
-    return makeDoserateColor(spec.doserate());
+    mColorColumnName.clear();
+    std::vector<double>().swap(mColorColumn);
+    mMinColorValue = mMaxColorValue = 0.0;
 }
 
 } // namespace Gamma
@@ -20,71 +20,118 @@
 #include "exceptions.h"
 #include "detector.h"
 #include "spectrum.h"
+#include "spectrumstore.h"
+#include "sessionbounds.h"
+#include "loadstatistics.h"
+#include "geweighttable.h"
+#include "doserateplugin.h"
+#include "luastate.h"
+#include "channelcache.h"
 #include "geo.h"
+#include "colormap.h"
+#include <atomic>
+#include <functional>
 #include <memory>
 #include <vector>
 #include <QString>
+#include <QStringList>
+#include <QByteArray>
 #include <QVector3D>
-#include <QColor>
-#include <QtSql>
-
-extern "C"
-{
-#include "lua/lua.h"
-#include "lua/lualib.h"
-#include "lua/lauxlib.h"
-}
 
 namespace Gamma
 {
 
-struct LuaStateDeleter
-{
-    void operator () (lua_State *L) const
-    {
-        if(L) { lua_close(L); }
-    }
-};
-
-typedef std::unique_ptr<lua_State, LuaStateDeleter> LuaStatePointer;
-typedef std::vector<std::unique_ptr<Spectrum>> SpectrumList;
-typedef SpectrumList::size_type SpectrumListSize;
+class SessionCache;
+class SessionReader;
+class StackedWeights;
+typedef std::function<void(SpectrumStore &&chunk, int loaded, int total)> SpectrumChunkHandler;
+typedef std::function<void(int done, int total)> ProgressHandler;
 
 class Session
 {
 public:
 
-    Session(QString sessionFileName, QString doserateScriptFileName);
+    // Doserate scripts are loaded with the session by readDatabaseFile
+    explicit Session(QStringList doserateScriptFileNames);
     Session(const Session &rhs) = delete;
     ~Session();
 
     Session &operator = (const Session &) = delete;
 
-    const SpectrumList &spectrumList() const;
-    SpectrumListSize spectrumCount() const { return mSpectrumList.size(); }
-    const Spectrum &spectrum(SpectrumListSize index) const;
+    const SpectrumStore &spectrumStore() const { return mSpectra; }
+    SpectrumStoreSize spectrumCount() const { return mSpectra.size(); }
+    Spectrum spectrum(SpectrumStoreSize index) const;
+
+    // With lazy channels only metadata and doserates are kept in the store,
+    // channels are read from the database on demand by the GUI thread
+    void setLazyChannels(bool state) { mLazyChannels = state; }
+    bool lazyChannels() const { return mLazyChannels; }
+    std::vector<int> spectrumChannels(SpectrumStoreSize index);
+
+    // Connection for workers reading channels of a loaded session. The
+    // reader must be created, used and destroyed by the worker thread.
+    std::unique_ptr<SessionReader> makeReader(QString purpose) const;
+
+    static const std::size_t ChannelCacheSize = 4096;
+
+    // Every doserate script is a dose model with its own doserate column,
+    // the active model provides the doserates used for colouring. Without
+    // scripts the compiled plugin of the detector is the only model.
+    void loadDoserateScripts(const QStringList &scriptFileNames);
+    QStringList doseModelNames() const;
+    std::size_t doseModelCount() const { return mModels.size(); }
+    std::size_t activeDoseModel() const { return mActiveModel; }
+    void setActiveDoseModel(std::size_t model);
+
+    // Models and doserates of all spectra for new scripts. They are
+    // calculated on a loader thread without changing the session, using the
+    // channels in memory when they are kept, and swapped in by
+    // commitDoserateUpdate on the GUI thread. A failing script leaves the
+    // session as it was. Returns null when cancelled.
+    struct DoserateUpdate;
+    std::shared_ptr<DoserateUpdate> calculateDoserateUpdate(const QStringList &scriptFileNames,
+                                                            const std::atomic_bool &cancelled,
+                                                            const ProgressHandler &progress) const;
+    void commitDoserateUpdate(DoserateUpdate &update);
 
-    void loadDoserateScript(QString scriptFileName);
     void loadDatabaseFile(QString databaseFileName);
 
+    // Safe to call from a loader thread, each session uses its own
+    // database connections
+    bool readDatabaseFile(QString databaseFileName,
+                          const std::atomic_bool &cancelled,
+                          SpectrumStoreSize chunkSize,
+                          const SpectrumChunkHandler &handler);
+
+    void appendSpectra(SpectrumStore &&spectra);
+
+    // Appends spectra written to the database after the last one seen,
+    // returns the number of new spectra. Used by the GUI thread only.
+    SpectrumStoreSize readNewSpectra();
+
     QString name() const { return mName; }
+    const Detector &detector() const { return mDetector; }
 
-    double minDoserate() const { return mMinDoserate; }
-    double maxDoserate() const { return mMaxDoserate; }
+    double minDoserate() const { return mBounds.minDoserate; }
+    double maxDoserate() const { return mBounds.maxDoserate; }
 
-    double minX() const { return mMinX; }
-    double maxX() const { return mMaxX; }
-    double minY() const { return mMinY; }
-    double maxY() const { return mMaxY; }
-    double minZ() const { return mMinZ; }
-    double maxZ() const { return mMaxZ; }
+    double minX() const { return mBounds.minX; }
+    double maxX() const { return mBounds.maxX; }
+    double minY() const { return mBounds.minY; }
+    double maxY() const { return mBounds.maxY; }
+    double minZ() const { return mBounds.minZ; }
+    double maxZ() const { return mBounds.maxZ; }
 
     double halfX() const { return mHalfX; }
     double halfY() const { return mHalfY; }
     double halfZ() const { return mHalfZ; }
 
-    double minAltitude() const { return mMinAltitude; }
-    double maxAltitude() const { return mMaxAltitude; }
+    double minAltitude() const { return mBounds.minAltitude; }
+    double maxAltitude() const { return mBounds.maxAltitude; }
+
+    const SessionBounds &bounds() const { return mBounds; }
+
+    const LoadStatistics &loadStatistics() const { return mLoadStatistics; }
 
     void useLogarithmicDoserateColor(bool state) { mLogarithmicColorScale = state; }
 
@@ -93,8 +140,15 @@ public:
 
     void clear();
 
-    QColor makeDoserateColor(double doserate) const;
-    QColor makeDoserateColor(const Spectrum &spec) const;
+    // Colours of the spectra from first to the last one, packed the way
+    // instance buffers take them
+    void makeDoserateColors(std::vector<ColorRGBA8> &colors, SpectrumStoreSize first = 0) const;
+
+    // A column computed by an analysis script is used for colouring instead
+    // of the doserates while it is set. Appending spectra clears it.
+    void setColorColumn(QString name, std::vector<double> values);
+    void clearColorColumn();
+    QString colorColumnName() const { return mColorColumnName; }
 
     struct Exception_UnableToCreateLuaState : public Exception
     {
@@ -102,6 +156,12 @@ public:
             : Exception("Unable to create Lua state: " + source) {}
     };
 
+    struct Exception_SpectrumNotFound : public Exception
+    {
+        explicit Exception_SpectrumNotFound(QString source) noexcept
+            : Exception("Spectrum not found: " + source) {}
+    };
+
     struct Exception_LoadDoserateScriptFailed : public Exception
     {
         explicit Exception_LoadDoserateScriptFailed(QString filename) noexcept
@@ -110,28 +170,86 @@ public:
 
 private:
 
-    void loadSessionQuery(QSqlQuery &query);
+    struct DoseModel
+    {
+        QString fileName;
+        QString key;
+        LuaStatePointer L;
+        bool cacheable;
+        std::shared_ptr<LuaStatePool> pool;
+        DoseratePluginPointer plugin;
+        GEWeightTablePointer weights;
+    };
 
+    DoseModel loadDoseModel(QString scriptFileName) const;
+    bool makeNativeDoseModel(DoseModel &model) const;
+    void loadNativeDoseModel();
+    void loadSessionInfo(QString name,
+                         QString comment,
+                         double livetime,
+                         QByteArray detectorData);
+    SessionReader &reader();
+    void updateGEWeights();
+    void updateGEWeights(std::vector<DoseModel> &models,
+                         std::unique_ptr<StackedWeights> &stackedWeights) const;
+    QString connectionName(QString purpose) const;
+    void calculateDoserates(SpectrumStore &chunk);
+    void calculateDoserates(const SpectrumStore &spectra,
+                            SpectrumStoreSize begin,
+                            SpectrumStoreSize end,
+                            std::vector<DoseModel> &models,
+                            const StackedWeights *stackedWeights,
+                            double *doserates) const;
+    void calculateScriptedDoserates(const SpectrumStore &spectra,
+                                    SpectrumStoreSize begin,
+                                    SpectrumStoreSize end,
+                                    std::vector<DoseModel> &models,
+                                    std::size_t model,
+                                    double *doserates) const;
+    void updateDoserateBounds();
+    LuaArena::Statistics luaAllocStatistics() const;
+    qint64 luaScriptTime() const;
+    void resetLuaStatistics();
+    bool readSessionCache(SessionCache &cache,
+                          const std::atomic_bool &cancelled,
+                          const SpectrumChunkHandler &handler);
+    void updateCenter();
+
+    QString mConnectionName;
+    QString mDatabaseFileName;
     QString mName;
     QString mComment;
+    QByteArray mDetectorData;
 
     Detector mDetector;
 
-    SpectrumList mSpectrumList;
+    SpectrumStore mSpectra;
+
+    bool mLazyChannels;
+    ChannelCache mChannelCache;
+    std::unique_ptr<SessionReader> mReader;
+    int mLastSessionIndex;
 
-    LuaStatePointer L;
-    bool mScriptLoaded;
+    QStringList mPendingScriptFileNames;
+    std::vector<DoseModel> mModels;
+    std::unique_ptr<StackedWeights> mStackedWeights;
+    std::size_t mActiveModel;
+    QString mScriptKey;
 
     double mLivetime;
-    double mMinDoserate, mMaxDoserate;
-    double mMinX, mMaxX, mMinY, mMaxY, mMinZ, mMaxZ;
+    SessionBounds mBounds;
+    LoadStatistics mLoadStatistics;
     double mHalfX, mHalfY, mHalfZ;
-    double mMinLatitude, mMaxLatitude;
-    double mMinLongitude, mMaxLongitude;
-    double mMinAltitude, mMaxAltitude;
     bool mLogarithmicColorScale;
+
+    QString mColorColumnName;
+    std::vector<double> mColorColumn;
+    double mMinColorValue;
+    double mMaxColorValue;
 };
 
+typedef std::shared_ptr<Session::DoserateUpdate> DoserateUpdatePointer;
+
 } // namespace Gamma
 
 #endif // SESSION_H
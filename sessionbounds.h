@@ -0,0 +1,104 @@
+//  gamma-viewer-3d - 3d visualization of sessions generated by gamma-analyzer
+//  Copyright (C) 2017  Dag Robole
+//
+//  This program is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef SESSIONBOUNDS_H
+#define SESSIONBOUNDS_H
+
+#include <QVector3D>
+
+namespace Gamma
+{
+
+struct SessionBounds
+{
+    SessionBounds() { clear(); }
+
+    void clear()
+    {
+        valid = false;
+        minDoserate = maxDoserate = 0.0;
+        minX = maxX = minY = maxY = minZ = maxZ = 0.0;
+        minLatitude = maxLatitude = 0.0;
+        minLongitude = maxLongitude = 0.0;
+        minAltitude = maxAltitude = 0.0;
+    }
+
+    void include(double doserate,
+                 const QVector3D &position,
+                 double latitude,
+                 double longitude,
+                 double altitude)
+    {
+        if(!valid)
+        {
+            valid = true;
+            minDoserate = maxDoserate = doserate;
+            minX = maxX = position.x();
+            minY = maxY = position.y();
+            minZ = maxZ = position.z();
+            minLatitude = maxLatitude = latitude;
+            minLongitude = maxLongitude = longitude;
+            minAltitude = maxAltitude = altitude;
+            return;
+        }
+
+        if(minDoserate > doserate)
+            minDoserate = doserate;
+        if(maxDoserate < doserate)
+            maxDoserate = doserate;
+
+        if(minX > position.x())
+            minX = position.x();
+        if(maxX < position.x())
+            maxX = position.x();
+
+        if(minY > position.y())
+            minY = position.y();
+        if(maxY < position.y())
+            maxY = position.y();
+
+        if(minZ > position.z())
+            minZ = position.z();
+        if(maxZ < position.z())
+            maxZ = position.z();
+
+        if(minLatitude > latitude)
+            minLatitude = latitude;
+        if(maxLatitude < latitude)
+            maxLatitude = latitude;
+
+        if(minLongitude > longitude)
+            minLongitude = longitude;
+        if(maxLongitude < longitude)
+            maxLongitude = longitude;
+
+        if(minAltitude > altitude)
+            minAltitude = altitude;
+        if(maxAltitude < altitude)
+            maxAltitude = altitude;
+    }
+
+    bool valid;
+    double minDoserate, maxDoserate;
+    double minX, maxX, minY, maxY, minZ, maxZ;
+    double minLatitude, maxLatitude;
+    double minLongitude, maxLongitude;
+    double minAltitude, maxAltitude;
+};
+
+} // namespace Gamma
+
+#endif // SESSIONBOUNDS_H
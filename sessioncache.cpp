@@ -0,0 +1,298 @@
+//  gamma-viewer-3d - 3d visualization of sessions generated by gamma-analyzer
+//  Copyright (C) 2017  Dag Robole
+//
+//  This program is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "sessioncache.h"
+#include <cstring>
+#include <QFileInfo>
+#include <QDateTime>
+#include <QCryptographicHash>
+#include <QDebug>
+
+namespace Gamma
+{
+
+static const char CacheMagic[8] = { 'G', 'V', '3', 'D', 'S', 'E', 'S', 'S' };
+
+struct CacheTrailer
+{
+    quint64 spectrumCount;
+    quint64 boundsValid;
+    double bounds[14];
+};
+
+static bool writeRaw(QIODevice &device, const void *data, std::size_t size)
+{
+    static const char zeros[8] = {};
+
+    if(size && device.write(static_cast<const char*>(data), (qint64)size) != (qint64)size)
+        return false;
+
+    qint64 padding = (qint64)((8 - size % 8) % 8);
+    return padding == 0 || device.write(zeros, padding) == padding;
+}
+
+static bool writeBytes(QIODevice &device, const QByteArray &bytes)
+{
+    quint64 size = (quint64)bytes.size();
+    return writeRaw(device, &size, sizeof(size)) &&
+            writeRaw(device, bytes.constData(), (std::size_t)bytes.size());
+}
+
+static bool readRaw(const uchar *&data, const uchar *end, void *out, std::size_t size)
+{
+    std::size_t padded = (size + 7) & ~(std::size_t)7;
+    if((std::size_t)(end - data) < padded)
+        return false;
+
+    std::memcpy(out, data, size);
+    data += padded;
+
+    return true;
+}
+
+static bool readBytes(const uchar *&data, const uchar *end, QByteArray &bytes)
+{
+    quint64 size;
+    if(!readRaw(data, end, &size, sizeof(size)))
+        return false;
+
+    std::size_t padded = ((std::size_t)size + 7) & ~(std::size_t)7;
+    if(size > (quint64)(end - data) || padded > (std::size_t)(end - data))
+        return false;
+
+    bytes = QByteArray(reinterpret_cast<const char*>(data), (int)size);
+    data += padded;
+
+    return true;
+}
+
+static void boundsToArray(const SessionBounds &b, double *a)
+{
+    double values[14] = {
+        b.minDoserate, b.maxDoserate,
+        b.minX, b.maxX, b.minY, b.maxY, b.minZ, b.maxZ,
+        b.minLatitude, b.maxLatitude,
+        b.minLongitude, b.maxLongitude,
+        b.minAltitude, b.maxAltitude
+    };
+    std::memcpy(a, values, sizeof(values));
+}
+
+static void boundsFromArray(const double *a, SessionBounds &b)
+{
+    b.minDoserate = a[0]; b.maxDoserate = a[1];
+    b.minX = a[2]; b.maxX = a[3];
+    b.minY = a[4]; b.maxY = a[5];
+    b.minZ = a[6]; b.maxZ = a[7];
+    b.minLatitude = a[8]; b.maxLatitude = a[9];
+    b.minLongitude = a[10]; b.maxLongitude = a[11];
+    b.minAltitude = a[12]; b.maxAltitude = a[13];
+}
+
+SessionCache::SessionCache(QString databaseFileName, QString scriptKey)
+    :
+      mDatabaseFileName(databaseFileName),
+      mScriptKey(scriptKey),
+      mFileName(databaseFileName + ".gv3dcache"),
+      mCursor(nullptr),
+      mBlocksEnd(nullptr),
+      mFailed(false),
+      mTrailerOffsetPosition(0),
+      mLivetime(0.0),
+      mSpectrumCount(0)
+{
+    // Taken before the database is opened, which may touch its WAL file
+    mKey = makeKey();
+}
+
+QByteArray SessionCache::makeKey() const
+{
+    // Rows written by a running survey may only be in the WAL file so far
+    QFileInfo dbInfo(mDatabaseFileName);
+    QFileInfo walInfo(mDatabaseFileName + "-wal");
+    bool hasWal = walInfo.exists() && walInfo.size() > 0;
+
+    qint64 values[4] = {
+        dbInfo.size(),
+        dbInfo.lastModified().toMSecsSinceEpoch(),
+        hasWal ? walInfo.size() : 0,
+        hasWal ? walInfo.lastModified().toMSecsSinceEpoch() : 0
+    };
+
+    QByteArray key(reinterpret_cast<const char*>(values), sizeof(values));
+    key += QCryptographicHash::hash(mScriptKey.toUtf8(), QCryptographicHash::Sha1);
+
+    return key;
+}
+
+bool SessionCache::open()
+{
+    mFile.setFileName(mFileName);
+    if(!mFile.exists() || !mFile.open(QIODevice::ReadOnly))
+        return false;
+
+    const uchar *data = mFile.map(0, mFile.size());
+    if(!data)
+        return false;
+
+    const uchar *end = data + mFile.size();
+    const uchar *cursor = data;
+
+    char magic[8];
+    quint64 version;
+    QByteArray key;
+    quint64 trailerOffset;
+
+    if(!readRaw(cursor, end, magic, sizeof(magic)) ||
+            std::memcmp(magic, CacheMagic, sizeof(magic)) != 0 ||
+            !readRaw(cursor, end, &version, sizeof(version)) ||
+            version != Version ||
+            !readBytes(cursor, end, key) ||
+            key != mKey ||
+            !readRaw(cursor, end, &trailerOffset, sizeof(trailerOffset)))
+        return false;
+
+    QByteArray name, comment;
+    if(!readBytes(cursor, end, name) ||
+            !readBytes(cursor, end, comment) ||
+            !readBytes(cursor, end, mDetectorData) ||
+            !readRaw(cursor, end, &mLivetime, sizeof(mLivetime)))
+        return false;
+
+    // Caches are only committed complete, a trailer past the end is damage
+    CacheTrailer trailer;
+    if(trailerOffset < (quint64)(cursor - data) ||
+            trailerOffset + sizeof(trailer) > (quint64)mFile.size())
+        return false;
+
+    std::memcpy(&trailer, data + trailerOffset, sizeof(trailer));
+
+    mName = QString::fromUtf8(name);
+    mComment = QString::fromUtf8(comment);
+    mSpectrumCount = trailer.spectrumCount;
+    mBounds.valid = trailer.boundsValid != 0;
+    boundsFromArray(trailer.bounds, mBounds);
+
+    mCursor = cursor;
+    mBlocksEnd = data + trailerOffset;
+
+    return true;
+}
+
+bool SessionCache::readChunk(SpectrumStore &chunk, bool withChannels)
+{
+    if(mFailed || !mCursor || mCursor >= mBlocksEnd)
+        return false;
+
+    if(!chunk.appendBlock(mCursor, mBlocksEnd, withChannels))
+    {
+        qDebug() << "Session cache is damaged:" << mFileName;
+        mFailed = true;
+        return false;
+    }
+
+    return true;
+}
+
+void SessionCache::remove()
+{
+    mFile.close();
+    mCursor = mBlocksEnd = nullptr;
+    QFile::remove(mFileName);
+}
+
+void SessionCache::beginWrite(QString name,
+                              QString comment,
+                              double livetime,
+                              QByteArray detectorData)
+{
+    mSaveFile = std::make_unique<QSaveFile>(mFileName);
+    mSpectrumCount = 0;
+    mBounds.clear();
+
+    quint64 version = Version;
+    quint64 trailerOffset = 0;
+
+    bool ok = mSaveFile->open(QIODevice::WriteOnly) &&
+            writeRaw(*mSaveFile, CacheMagic, sizeof(CacheMagic)) &&
+            writeRaw(*mSaveFile, &version, sizeof(version)) &&
+            writeBytes(*mSaveFile, mKey);
+
+    mTrailerOffsetPosition = mSaveFile->pos();
+
+    ok = ok &&
+            writeRaw(*mSaveFile, &trailerOffset, sizeof(trailerOffset)) &&
+            writeBytes(*mSaveFile, name.toUtf8()) &&
+            writeBytes(*mSaveFile, comment.toUtf8()) &&
+            writeBytes(*mSaveFile, detectorData) &&
+            writeRaw(*mSaveFile, &livetime, sizeof(livetime));
+
+    if(!ok)
+    {
+        qDebug() << "Unable to write session cache:" << mFileName;
+        mSaveFile.reset();
+    }
+}
+
+void SessionCache::writeChunk(const SpectrumStore &chunk)
+{
+    if(!mSaveFile)
+        return;
+
+    if(!chunk.writeBlock(*mSaveFile))
+    {
+        qDebug() << "Unable to write session cache:" << mFileName;
+        mSaveFile.reset();
+        return;
+    }
+
+    const auto &doserates = chunk.doserates();
+    const auto &positions = chunk.positions();
+    const auto &latitudes = chunk.latitudes();
+    const auto &longitudes = chunk.longitudes();
+    const auto &altitudes = chunk.altitudes();
+
+    for(SpectrumStoreSize i = 0; i < chunk.size(); i++)
+        mBounds.include(doserates[i], positions[i],
+                        latitudes[i], longitudes[i], altitudes[i]);
+
+    mSpectrumCount += chunk.size();
+}
+
+void SessionCache::commit()
+{
+    if(!mSaveFile)
+        return;
+
+    CacheTrailer trailer;
+    trailer.spectrumCount = mSpectrumCount;
+    trailer.boundsValid = mBounds.valid ? 1 : 0;
+    boundsToArray(mBounds, trailer.bounds);
+
+    quint64 trailerOffset = (quint64)mSaveFile->pos();
+
+    bool ok = writeRaw(*mSaveFile, &trailer, sizeof(trailer)) &&
+            mSaveFile->seek(mTrailerOffsetPosition) &&
+            writeRaw(*mSaveFile, &trailerOffset, sizeof(trailerOffset)) &&
+            mSaveFile->commit();
+
+    if(!ok)
+        qDebug() << "Unable to write session cache:" << mFileName;
+
+    mSaveFile.reset();
+}
+
+} // namespace Gamma
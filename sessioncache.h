@@ -0,0 +1,98 @@
+//  gamma-viewer-3d - 3d visualization of sessions generated by gamma-analyzer
+//  Copyright (C) 2017  Dag Robole
+//
+//  This program is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef SESSIONCACHE_H
+#define SESSIONCACHE_H
+
+#include "spectrumstore.h"
+#include "sessionbounds.h"
+#include <memory>
+#include <QString>
+#include <QByteArray>
+#include <QFile>
+#include <QSaveFile>
+
+namespace Gamma
+{
+
+// Binary sidecar file next to a session database, holding everything a load
+// produces so the session can be reopened from a mapped file without SQL,
+// parsing or doserate scripts. A cache is only used while the database size
+// and modification time, and the doserate script, match the ones it was
+// written with.
+class SessionCache
+{
+public:
+
+    SessionCache(QString databaseFileName, QString scriptKey);
+    SessionCache(const SessionCache &rhs) = delete;
+    ~SessionCache() = default;
+
+    SessionCache &operator = (const SessionCache &) = delete;
+
+    QString fileName() const { return mFileName; }
+
+    // Maps the cache file, returns false if it is missing or out of date
+    bool open();
+    bool readChunk(SpectrumStore &chunk, bool withChannels = true);
+    bool failed() const { return mFailed; }
+    void remove();
+
+    QString name() const { return mName; }
+    QString comment() const { return mComment; }
+    double livetime() const { return mLivetime; }
+    QByteArray detectorData() const { return mDetectorData; }
+    quint64 spectrumCount() const { return mSpectrumCount; }
+    const SessionBounds &bounds() const { return mBounds; }
+
+    // Writing never throws, a cache that can not be written is skipped
+    void beginWrite(QString name,
+                    QString comment,
+                    double livetime,
+                    QByteArray detectorData);
+    void writeChunk(const SpectrumStore &chunk);
+    void commit();
+
+    static const quint32 Version = 2;
+
+private:
+
+    QByteArray makeKey() const;
+
+    QString mDatabaseFileName;
+    QString mScriptKey;
+    QString mFileName;
+    QByteArray mKey;
+
+    QFile mFile;
+    const uchar *mCursor;
+    const uchar *mBlocksEnd;
+    bool mFailed;
+
+    std::unique_ptr<QSaveFile> mSaveFile;
+    qint64 mTrailerOffsetPosition;
+
+    QString mName;
+    QString mComment;
+    double mLivetime;
+    QByteArray mDetectorData;
+    quint64 mSpectrumCount;
+    SessionBounds mBounds;
+};
+
+} // namespace Gamma
+
+#endif // SESSIONCACHE_H
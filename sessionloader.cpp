@@ -0,0 +1,112 @@
+//  gamma-viewer-3d - 3d visualization of sessions generated by gamma-analyzer
+//  Copyright (C) 2017  Dag Robole
+//
+//  This program is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "sessionloader.h"
+#include "luasession.h"
+#include <exception>
+#include <QFileInfo>
+
+SessionLoader::SessionLoader(Gamma::Session *session,
+                             QString databaseFileName,
+                             QObject *parent)
+    :
+      QObject(parent),
+      mSession(session),
+      mDatabaseFileName(databaseFileName),
+      mJob(LoadSession),
+      mCancelled(false)
+{
+    qRegisterMetaType<Gamma::SpectrumChunk>("Gamma::SpectrumChunk");
+}
+
+SessionLoader::SessionLoader(Gamma::Session *session,
+                             QString databaseFileName,
+                             Job job,
+                             QStringList scriptFileNames,
+                             QObject *parent)
+    :
+      QObject(parent),
+      mSession(session),
+      mDatabaseFileName(databaseFileName),
+      mJob(job),
+      mScriptFileNames(scriptFileNames),
+      mCancelled(false)
+{
+    qRegisterMetaType<Gamma::DoserateUpdatePointer>("Gamma::DoserateUpdatePointer");
+    qRegisterMetaType<Gamma::AnalysisColumn>("Gamma::AnalysisColumn");
+}
+
+void SessionLoader::run()
+{
+    try
+    {
+        if(!mSession)
+            throw Exception_InvalidPointer("SessionLoader::run: session");
+
+        if(mJob == RunAnalysisScript)
+        {
+            // The GUI thread sets the column, one script per job
+            QString scriptFileName = mScriptFileNames.value(0);
+            auto column = std::make_shared<std::vector<double>>(
+                        Gamma::runAnalysisScript(*mSession, scriptFileName, mCancelled));
+
+            emit analysisFinished(QFileInfo(scriptFileName).completeBaseName(), column);
+            return;
+        }
+
+        if(mJob == ApplyDoserateScripts)
+        {
+            // The session is only read here, the GUI thread swaps the
+            // result in
+            auto update = mSession->calculateDoserateUpdate(
+                        mScriptFileNames,
+                        mCancelled,
+                        [this](int done, int total) {
+                emit progress(done, total);
+            });
+
+            if(update)
+                emit doseratesCalculated(update);
+            else
+                emit cancelled();
+            return;
+        }
+
+        // Spectra are handed over in chunks and appended to the session by
+        // the GUI thread, which owns the scene
+        bool completed = mSession->readDatabaseFile(
+                    mDatabaseFileName,
+                    mCancelled,
+                    ChunkSize,
+                    [this](Gamma::SpectrumStore &&chunk, int loaded, int total) {
+            emit spectraLoaded(std::make_shared<Gamma::SpectrumStore>(std::move(chunk)));
+            emit progress(loaded, total);
+        });
+
+        if(completed)
+            emit finished();
+        else
+            emit cancelled();
+    }
+    catch(const std::exception &e)
+    {
+        // Scripts stopped by a cancel fail with an error
+        if(mCancelled)
+            emit cancelled();
+        else
+            emit failed(QString::fromStdString(e.what()));
+    }
+}
@@ -0,0 +1,96 @@
+//  gamma-viewer-3d - 3d visualization of sessions generated by gamma-analyzer
+//  Copyright (C) 2017  Dag Robole
+//
+//  This program is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef SESSIONLOADER_H
+#define SESSIONLOADER_H
+
+#include "session.h"
+#include <atomic>
+#include <memory>
+#include <vector>
+#include <QObject>
+#include <QString>
+#include <QStringList>
+#include <QMetaType>
+
+namespace Gamma
+{
+
+typedef std::shared_ptr<SpectrumStore> SpectrumChunk;
+typedef std::shared_ptr<std::vector<double>> AnalysisColumn;
+
+} // namespace Gamma
+
+Q_DECLARE_METATYPE(Gamma::SpectrumChunk)
+Q_DECLARE_METATYPE(Gamma::DoserateUpdatePointer)
+Q_DECLARE_METATYPE(Gamma::AnalysisColumn)
+
+class SessionLoader : public QObject
+{
+    Q_OBJECT
+
+public:
+
+    // Jobs other than loading work on a loaded session. They only read it,
+    // the result is handed over by doseratesCalculated or analysisFinished.
+    enum Job
+    {
+        LoadSession,
+        ApplyDoserateScripts,
+        RunAnalysisScript
+    };
+
+    SessionLoader(Gamma::Session *session,
+                  QString databaseFileName,
+                  QObject *parent = nullptr);
+
+    SessionLoader(Gamma::Session *session,
+                  QString databaseFileName,
+                  Job job,
+                  QStringList scriptFileNames,
+                  QObject *parent = nullptr);
+
+    QString databaseFileName() const { return mDatabaseFileName; }
+    Job job() const { return mJob; }
+
+    void cancel() { mCancelled = true; }
+
+    static const Gamma::SpectrumStoreSize ChunkSize = 1000;
+
+public slots:
+
+    void run();
+
+signals:
+
+    void progress(int loaded, int total);
+    void spectraLoaded(Gamma::SpectrumChunk chunk);
+    void doseratesCalculated(Gamma::DoserateUpdatePointer update);
+    void analysisFinished(QString columnName, Gamma::AnalysisColumn column);
+    void finished();
+    void cancelled();
+    void failed(QString message);
+
+private:
+
+    Gamma::Session *mSession;
+    QString mDatabaseFileName;
+    Job mJob;
+    QStringList mScriptFileNames;
+    std::atomic_bool mCancelled;
+};
+
+#endif // SESSIONLOADER_H
@@ -0,0 +1,394 @@
+//  gamma-viewer-3d - 3d visualization of sessions generated by gamma-analyzer
+//  Copyright (C) 2017  Dag Robole
+//
+//  This program is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "sessionreader.h"
+#include "channelparser.h"
+#include <QDateTime>
+#include <QtSql>
+
+#ifdef GAMMA_HAVE_SQLITE3
+#include <sqlite3.h>
+#endif
+
+namespace Gamma
+{
+
+static const char *SpectrumColumns =
+        "session_name, session_index, start_time, realtime, livetime, "
+        "latitude, longitude, altitude, channels";
+
+static const char *ChannelsQuery =
+        "SELECT channels FROM spectrum WHERE session_index = ?";
+
+static qint64 parseStartTime(const QString &text)
+{
+    auto startTime = QDateTime::fromString(text, Qt::DateFormat::ISODate);
+
+    return startTime.isValid() ?
+                startTime.toMSecsSinceEpoch() : SpectrumStore::InvalidTime;
+}
+
+namespace
+{
+
+struct DatabaseConnectionGuard
+{
+    explicit DatabaseConnectionGuard(QString name) : connectionName(name) {}
+    ~DatabaseConnectionGuard() { QSqlDatabase::removeDatabase(connectionName); }
+
+    QString connectionName;
+};
+
+class QtSqlSessionReader : public SessionReader
+{
+public:
+
+    QtSqlSessionReader(QString databaseFileName, QString connectionName, int busyTimeout)
+        :
+          mGuard(connectionName),
+          mDatabase(QSqlDatabase::addDatabase("QSQLITE", connectionName))
+    {
+        mDatabase.setDatabaseName(databaseFileName);
+        mDatabase.setConnectOptions(QStringLiteral("QSQLITE_BUSY_TIMEOUT=%1").arg(busyTimeout));
+        if(!mDatabase.open())
+            throw Exception_UnableToOpenDatabase(databaseFileName);
+    }
+
+    QString backendName() const override { return QStringLiteral("QtSql"); }
+
+    void readSession(QString &name,
+                     QString &comment,
+                     double &livetime,
+                     QByteArray &detectorData) override
+    {
+        QSqlQuery query(mDatabase);
+        if(!query.exec("SELECT name, comment, livetime, detector_data FROM session") ||
+                !query.next())
+            throw Exception_DatabaseQueryFailed(query.lastError().text());
+
+        name = query.value(0).toString();
+        comment = query.value(1).toString();
+        livetime = query.value(2).toInt();
+        detectorData = query.value(3).toString().toUtf8();
+    }
+
+    int spectrumCount() override
+    {
+        QSqlQuery query(mDatabase);
+        if(query.exec("SELECT COUNT(*) FROM spectrum") && query.next())
+            return query.value(0).toInt();
+
+        return 0;
+    }
+
+    void beginSpectra() override
+    {
+        mQuery = std::make_unique<QSqlQuery>(mDatabase);
+        mQuery->setForwardOnly(true);
+
+        if(!mQuery->exec(QStringLiteral("SELECT %1 FROM spectrum").arg(SpectrumColumns)))
+            throw Exception_DatabaseQueryFailed(mQuery->lastError().text());
+    }
+
+    void beginSpectraAfter(int sessionIndex) override
+    {
+        mQuery = std::make_unique<QSqlQuery>(mDatabase);
+        mQuery->setForwardOnly(true);
+
+        if(!mQuery->prepare(QStringLiteral("SELECT %1 FROM spectrum WHERE session_index > ?")
+                            .arg(SpectrumColumns)))
+            throw Exception_DatabaseQueryFailed(mQuery->lastError().text());
+
+        mQuery->bindValue(0, sessionIndex);
+        if(!mQuery->exec())
+            throwQueryError(mQuery->lastError());
+    }
+
+    bool readSpectrum(SpectrumStore &chunk) override
+    {
+        if(!mQuery)
+            return false;
+
+        if(!mQuery->next())
+        {
+            QSqlError error = mQuery->lastError();
+            mQuery->finish();
+            if(error.isValid())
+                throwQueryError(error);
+            return false;
+        }
+
+        if(chunk.empty())
+            chunk.setSessionName(mQuery->value(0).toString());
+
+        auto channels = mQuery->value(8).toString();
+
+        chunk.appendSpectrum(mQuery->value(1).toInt(),
+                             parseStartTime(mQuery->value(2).toString()),
+                             mQuery->value(3).toInt(),
+                             mQuery->value(4).toInt(),
+                             mQuery->value(5).toDouble(),
+                             mQuery->value(6).toDouble(),
+                             mQuery->value(7).toDouble(),
+                             channels.utf16(),
+                             (std::size_t)channels.size());
+        return true;
+    }
+
+    bool readChannels(int sessionIndex, std::vector<int> &channels) override
+    {
+        if(!mChannelQuery)
+        {
+            mChannelQuery = std::make_unique<QSqlQuery>(mDatabase);
+            mChannelQuery->setForwardOnly(true);
+            if(!mChannelQuery->prepare(ChannelsQuery))
+                throw Exception_DatabaseQueryFailed(mChannelQuery->lastError().text());
+        }
+
+        mChannelQuery->bindValue(0, sessionIndex);
+        if(!mChannelQuery->exec())
+            throw Exception_DatabaseQueryFailed(mChannelQuery->lastError().text());
+
+        bool found = mChannelQuery->next();
+        if(found)
+        {
+            auto text = mChannelQuery->value(0).toString();
+            channels.clear();
+            parseChannels(text.utf16(), (std::size_t)text.size(), channels);
+        }
+
+        mChannelQuery->finish();
+        return found;
+    }
+
+private:
+
+    static void throwQueryError(const QSqlError &error)
+    {
+        // SQLITE_BUSY
+        if(error.nativeErrorCode() == QLatin1String("5"))
+            throw Exception_DatabaseBusy(error.text());
+        throw Exception_DatabaseQueryFailed(error.text());
+    }
+
+    // Declared first so the connection is removed after the queries are gone
+    DatabaseConnectionGuard mGuard;
+    QSqlDatabase mDatabase;
+    std::unique_ptr<QSqlQuery> mQuery;
+    std::unique_ptr<QSqlQuery> mChannelQuery;
+};
+
+#ifdef GAMMA_HAVE_SQLITE3
+
+class Sqlite3SessionReader : public SessionReader
+{
+public:
+
+    Sqlite3SessionReader(QString databaseFileName, int busyTimeout)
+        :
+          mDatabase(nullptr),
+          mStatement(nullptr),
+          mChannelStatement(nullptr)
+    {
+        if(sqlite3_open_v2(databaseFileName.toUtf8().constData(),
+                           &mDatabase,
+                           SQLITE_OPEN_READONLY | SQLITE_OPEN_NOMUTEX,
+                           nullptr) != SQLITE_OK)
+        {
+            sqlite3_close(mDatabase);
+            throw Exception_UnableToOpenDatabase(databaseFileName);
+        }
+
+        // Let sqlite read the pages straight from the mapped file
+        sqlite3_exec(mDatabase, "PRAGMA mmap_size = 1073741824", nullptr, nullptr, nullptr);
+
+        // The database may be written by gamma-analyzer at the same time
+        sqlite3_busy_timeout(mDatabase, busyTimeout);
+    }
+
+    ~Sqlite3SessionReader() override
+    {
+        sqlite3_finalize(mChannelStatement);
+        sqlite3_finalize(mStatement);
+        sqlite3_close(mDatabase);
+    }
+
+    QString backendName() const override { return QStringLiteral("sqlite3"); }
+
+    void readSession(QString &name,
+                     QString &comment,
+                     double &livetime,
+                     QByteArray &detectorData) override
+    {
+        sqlite3_stmt *statement = prepare(
+                    "SELECT name, comment, livetime, detector_data FROM session");
+
+        if(sqlite3_step(statement) != SQLITE_ROW)
+        {
+            sqlite3_finalize(statement);
+            throw Exception_DatabaseQueryFailed(sqlite3_errmsg(mDatabase));
+        }
+
+        name = text(statement, 0);
+        comment = text(statement, 1);
+        livetime = sqlite3_column_int(statement, 2);
+        detectorData = QByteArray(
+                    reinterpret_cast<const char*>(sqlite3_column_text(statement, 3)),
+                    sqlite3_column_bytes(statement, 3));
+
+        sqlite3_finalize(statement);
+    }
+
+    int spectrumCount() override
+    {
+        sqlite3_stmt *statement = prepare("SELECT COUNT(*) FROM spectrum");
+
+        int count = 0;
+        if(sqlite3_step(statement) == SQLITE_ROW)
+            count = sqlite3_column_int(statement, 0);
+
+        sqlite3_finalize(statement);
+        return count;
+    }
+
+    void beginSpectra() override
+    {
+        sqlite3_finalize(mStatement);
+        mStatement = prepare(QStringLiteral("SELECT %1 FROM spectrum")
+                             .arg(SpectrumColumns).toUtf8());
+    }
+
+    void beginSpectraAfter(int sessionIndex) override
+    {
+        sqlite3_finalize(mStatement);
+        mStatement = prepare(QStringLiteral("SELECT %1 FROM spectrum WHERE session_index > ?")
+                             .arg(SpectrumColumns).toUtf8());
+        sqlite3_bind_int(mStatement, 1, sessionIndex);
+    }
+
+    bool readSpectrum(SpectrumStore &chunk) override
+    {
+        if(!mStatement)
+            return false;
+
+        int rc = sqlite3_step(mStatement);
+        if(rc == SQLITE_DONE)
+            return false;
+        if(rc != SQLITE_ROW)
+        {
+            // Resetting ends the read transaction, the query can be begun again
+            QString error = sqlite3_errmsg(mDatabase);
+            sqlite3_reset(mStatement);
+            throwError(rc, error);
+        }
+
+        if(chunk.empty())
+            chunk.setSessionName(text(mStatement, 0));
+
+        // Text pointers are valid until the next step
+        const char *startTime = reinterpret_cast<const char*>(sqlite3_column_text(mStatement, 2));
+        int startTimeSize = sqlite3_column_bytes(mStatement, 2);
+        const char *channels = reinterpret_cast<const char*>(sqlite3_column_text(mStatement, 8));
+        int channelsSize = sqlite3_column_bytes(mStatement, 8);
+
+        chunk.appendSpectrum(sqlite3_column_int(mStatement, 1),
+                             parseStartTime(QString::fromLatin1(startTime, startTimeSize)),
+                             sqlite3_column_int(mStatement, 3),
+                             sqlite3_column_int(mStatement, 4),
+                             sqlite3_column_double(mStatement, 5),
+                             sqlite3_column_double(mStatement, 6),
+                             sqlite3_column_double(mStatement, 7),
+                             channels,
+                             (std::size_t)channelsSize);
+        return true;
+    }
+
+    bool readChannels(int sessionIndex, std::vector<int> &channels) override
+    {
+        if(!mChannelStatement)
+            mChannelStatement = prepare(ChannelsQuery);
+
+        sqlite3_bind_int(mChannelStatement, 1, sessionIndex);
+
+        int rc = sqlite3_step(mChannelStatement);
+        if(rc == SQLITE_ROW)
+        {
+            const char *text = reinterpret_cast<const char*>(sqlite3_column_text(mChannelStatement, 0));
+            channels.clear();
+            parseChannels(text, (std::size_t)sqlite3_column_bytes(mChannelStatement, 0), channels);
+        }
+
+        QString error;
+        if(rc != SQLITE_ROW && rc != SQLITE_DONE)
+            error = sqlite3_errmsg(mDatabase);
+
+        // Resetting ends the read transaction, so writers are not held up
+        sqlite3_reset(mChannelStatement);
+
+        if(!error.isEmpty())
+            throwError(rc, error);
+
+        return rc == SQLITE_ROW;
+    }
+
+private:
+
+    sqlite3_stmt *prepare(const QByteArray &sql)
+    {
+        sqlite3_stmt *statement = nullptr;
+
+        int rc = sqlite3_prepare_v2(mDatabase, sql.constData(), -1, &statement, nullptr);
+        if(rc != SQLITE_OK)
+            throwError(rc, sqlite3_errmsg(mDatabase));
+
+        return statement;
+    }
+
+    static void throwError(int rc, QString message)
+    {
+        if(rc == SQLITE_BUSY || rc == SQLITE_LOCKED)
+            throw Exception_DatabaseBusy(message);
+        throw Exception_DatabaseQueryFailed(message);
+    }
+
+    static QString text(sqlite3_stmt *statement, int column)
+    {
+        const char *data = reinterpret_cast<const char*>(sqlite3_column_text(statement, column));
+        return QString::fromUtf8(data, sqlite3_column_bytes(statement, column));
+    }
+
+    sqlite3 *mDatabase;
+    sqlite3_stmt *mStatement;
+    sqlite3_stmt *mChannelStatement;
+};
+
+#endif // GAMMA_HAVE_SQLITE3
+
+} // namespace
+
+std::unique_ptr<SessionReader> makeSessionReader(QString databaseFileName,
+                                                 QString connectionName,
+                                                 int busyTimeout)
+{
+#ifdef GAMMA_HAVE_SQLITE3
+    if(qgetenv("GAMMA_VIEWER_SQL_BACKEND") != "qtsql")
+        return std::make_unique<Sqlite3SessionReader>(databaseFileName, busyTimeout);
+#endif
+
+    return std::make_unique<QtSqlSessionReader>(databaseFileName, connectionName, busyTimeout);
+}
+
+} // namespace Gamma
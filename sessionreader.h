@@ -0,0 +1,87 @@
+//  gamma-viewer-3d - 3d visualization of sessions generated by gamma-analyzer
+//  Copyright (C) 2017  Dag Robole
+//
+//  This program is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef SESSIONREADER_H
+#define SESSIONREADER_H
+
+#include "exceptions.h"
+#include "spectrumstore.h"
+#include <memory>
+#include <vector>
+#include <QString>
+#include <QByteArray>
+
+namespace Gamma
+{
+
+// Forward-only reader for the session and spectrum tables of a session
+// database. Readers are used by the thread that created them only.
+class SessionReader
+{
+public:
+
+    virtual ~SessionReader() = default;
+
+    virtual QString backendName() const = 0;
+
+    virtual void readSession(QString &name,
+                             QString &comment,
+                             double &livetime,
+                             QByteArray &detectorData) = 0;
+
+    virtual int spectrumCount() = 0;
+
+    virtual void beginSpectra() = 0;
+
+    // Like beginSpectra, limited to spectra added after the given one
+    virtual void beginSpectraAfter(int sessionIndex) = 0;
+
+    // Appends the next spectrum to chunk, returns false when done
+    virtual bool readSpectrum(SpectrumStore &chunk) = 0;
+
+    // Replaces channels with those of a single spectrum, returns false if
+    // there is no spectrum with the given session index
+    virtual bool readChannels(int sessionIndex, std::vector<int> &channels) = 0;
+
+    struct Exception_DatabaseQueryFailed : public Exception
+    {
+        explicit Exception_DatabaseQueryFailed(QString message) noexcept
+            : Exception("Database query failed: " + message) {}
+    };
+
+    // A writer held the database lock for longer than the busy timeout
+    struct Exception_DatabaseBusy : public Exception_DatabaseQueryFailed
+    {
+        explicit Exception_DatabaseBusy(QString message) noexcept
+            : Exception_DatabaseQueryFailed(message) {}
+    };
+};
+
+// Readers on worker threads can afford to wait for writers, readers used
+// from the GUI thread give up quickly and try again later
+const int LoaderBusyTimeout = 2000;
+const int InteractiveBusyTimeout = 50;
+
+// Uses sqlite3 directly when available, unless GAMMA_VIEWER_SQL_BACKEND is
+// set to "qtsql". The connection name is only used by the Qt SQL backend.
+// The busy timeout is in milliseconds.
+std::unique_ptr<SessionReader> makeSessionReader(QString databaseFileName,
+                                                 QString connectionName,
+                                                 int busyTimeout);
+
+} // namespace Gamma
+
+#endif // SESSIONREADER_H
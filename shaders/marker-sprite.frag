@@ -0,0 +1,21 @@
+#version 150 core
+
+in vec2 corner;
+in vec4 color;
+
+out vec4 fragColor;
+
+void main()
+{
+    float r2 = dot(corner, corner);
+    if(r2 > 1.0)
+        discard;
+
+    // Normal of a sphere seen head on, lit like the sphere markers
+    vec3 n = vec3(corner, sqrt(1.0 - r2));
+    float diffuse = n.z;
+    float specular = pow(diffuse, 3.0) * 0.08;
+
+    vec3 ambient = color.rgb * 0.9 * 0.2;
+    fragColor = vec4(ambient + color.rgb * diffuse * 0.8 + vec3(specular), color.a);
+}
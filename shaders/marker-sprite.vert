@@ -0,0 +1,39 @@
+#version 150 core
+
+// Corner of the sprite quad, from -1 to 1 in x and y
+in vec3 vertexPosition;
+
+// Per instance, one entry for every spectrum
+in vec3 instancePosition;
+in float instanceScale;
+in vec4 instanceColor;
+
+out vec2 corner;
+out vec4 color;
+
+uniform mat4 modelView;
+uniform mat4 projectionMatrix;
+uniform mat4 mvp;
+uniform mat4 viewportMatrix;
+
+// Sprite radius in pixels, or zero for instanceScale in world units
+uniform float screenRadius;
+
+void main()
+{
+    corner = vertexPosition.xy;
+    color = instanceColor;
+
+    if(screenRadius > 0.0)
+    {
+        // The viewport matrix scales clip space by half the viewport size
+        vec4 center = mvp * vec4(instancePosition, 1.0);
+        vec2 pixel = vec2(1.0 / viewportMatrix[0][0], 1.0 / viewportMatrix[1][1]);
+        gl_Position = center + vec4(corner * screenRadius * pixel * center.w, 0.0, 0.0);
+    }
+    else
+    {
+        vec4 center = modelView * vec4(instancePosition, 1.0);
+        gl_Position = projectionMatrix * (center + vec4(corner * instanceScale, 0.0, 0.0));
+    }
+}
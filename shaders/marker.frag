@@ -0,0 +1,19 @@
+#version 150 core
+
+in vec3 normal;
+in vec3 position;
+in vec4 color;
+
+out vec4 fragColor;
+
+void main()
+{
+    // Headlight at the camera, close to the look of the old Phong spheres
+    vec3 n = normalize(normal);
+    vec3 v = normalize(-position);
+    float diffuse = max(dot(n, v), 0.0);
+    float specular = pow(diffuse, 3.0) * 0.08;
+
+    vec3 ambient = color.rgb * 0.9 * 0.2;
+    fragColor = vec4(ambient + color.rgb * diffuse * 0.8 + vec3(specular), color.a);
+}
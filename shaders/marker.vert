@@ -0,0 +1,28 @@
+#version 150 core
+
+in vec3 vertexPosition;
+in vec3 vertexNormal;
+
+// Per instance, one entry for every spectrum
+in vec3 instancePosition;
+in float instanceScale;
+in vec4 instanceColor;
+
+out vec3 normal;
+out vec3 position;
+out vec4 color;
+
+uniform mat4 modelView;
+uniform mat3 modelViewNormal;
+uniform mat4 mvp;
+
+void main()
+{
+    vec4 worldPosition = vec4(vertexPosition * instanceScale + instancePosition, 1.0);
+
+    normal = normalize(modelViewNormal * vertexNormal);
+    position = vec3(modelView * worldPosition);
+    color = instanceColor;
+
+    gl_Position = mvp * worldPosition;
+}
@@ -15,96 +15,35 @@
 //  along with this program.  If not, see <http://www.gnu.org/licenses/>.
 
 #include "spectrum.h"
-#include "detector.h"
 
 namespace Gamma
 {
 
-Spectrum::Spectrum(const QSqlQuery &query)
+QDateTime Spectrum::gpsTimeStart() const
 {
-    loadQuery(query);
+    qint64 msecs = mStore->startTimes()[mIndex];
+    if(msecs == SpectrumStore::InvalidTime)
+        return QDateTime();
+
+    return QDateTime::fromMSecsSinceEpoch(msecs, Qt::UTC);
 }
 
 int Spectrum::channel(ChannelListSize index) const
 {
-    if(index >= mChannels.size())
+    if(index >= numChannels())
         throw Exception_IndexOutOfBounds("Spectrum::channel");
 
-    return mChannels[index];
+    return channels()[index];
 }
 
-void Spectrum::loadQuery(const QSqlQuery &query)
+QGeoCoordinate Spectrum::coordinate() const
 {
-    int idSessionName = query.record().indexOf("session_name");
-    int idSessionIndex = query.record().indexOf("session_index");
-    int idRealtime = query.record().indexOf("realtime");
-    int idLivetime = query.record().indexOf("livetime");
-    int idLatitude = query.record().indexOf("latitude");
-    int idLongitude = query.record().indexOf("longitude");
-    int idAltitude = query.record().indexOf("altitude");
-    int idStartTime = query.record().indexOf("start_time");
-    int idChannels = query.record().indexOf("channels");
-
-    mSessionName = query.value(idSessionName).toString();
-    mSessionIndex = query.value(idSessionIndex).toInt();
-    mRealtime = query.value(idRealtime).toInt();
-    mLivetime = query.value(idLivetime).toInt();
-    coordinate.setLatitude(query.value(idLatitude).toDouble());
-    coordinate.setLongitude(query.value(idLongitude).toDouble());
-    coordinate.setAltitude(query.value(idAltitude).toDouble());
-    mGpsTimeStart = QDateTime::fromString(
-                query.value(idStartTime).toString(),
-                Qt::DateFormat::ISODate);
-
-    auto strChans = query.value(idChannels).toString();
-    auto strChanList = strChans.split(
-                ' ', QString::SplitBehavior::SkipEmptyParts);
-
-    mChannels.clear();
-
-    for(const auto &chan : strChanList)
-        mChannels.emplace_back(chan.toInt());
-
-    position = Geo::geodeticToCartesian(coordinate);
-}
-
-static double GEValue(lua_State *L, double energy)
-{
-    double ge;
-
-    lua_getglobal(L, "gevalue");
-    lua_pushnumber(L, energy);
-    lua_call(L, 1, 1);
-    ge = (double)lua_tonumber(L, -1);
-    lua_pop(L, 1);
-
-    return ge;
-}
-
-void Spectrum::calculateDoserate(const Detector &detector, lua_State *L)
-{
-    mDoserate = 0.0;
-
-    // Trim off discriminators
-    int startChan = (int)((double)detector.numChannels() *
-                          ((double)detector.LLD() / 100.0));
-    int endChan = (int)((double)detector.numChannels() *
-                        ((double)detector.ULD() / 100.0));
-    if(endChan > detector.numChannels()) // FIXME: Can not exceed 100% atm
-        endChan = detector.numChannels();
+    QGeoCoordinate coordinate;
+    coordinate.setLatitude(mStore->latitudes()[mIndex]);
+    coordinate.setLongitude(mStore->longitudes()[mIndex]);
+    coordinate.setAltitude(mStore->altitudes()[mIndex]);
 
-    // Accumulate doserates from each channel
-    for (int i = startChan; i < endChan; i++)
-    {
-        double sec = (double)mLivetime / 1000000.0;
-        double cps = mChannels[i] / sec;
-        double E = detector.getEnergy(i);
-        if (E < 0.05) // Energies below 0.05 are invalid
-            continue;
-        double GE = GEValue(L, E / 1000.0);
-        double chanDose = GE * cps * 60.0;
-        mDoserate += chanDose;
-    }
+    return coordinate;
 }
 
 } // namespace Gamma
@@ -18,67 +18,51 @@
 #define SPECTRUM_H
 
 #include "exceptions.h"
-#include "geo.h"
-#include <vector>
+#include "spectrumstore.h"
+#include <cstddef>
 #include <QString>
 #include <QDateTime>
 #include <QVector3D>
-#include <QtSql>
-
-extern "C"
-{
-#include "lua/lua.h"
-#include "lua/lualib.h"
-#include "lua/lauxlib.h"
-}
+#include <QGeoCoordinate>
 
 namespace Gamma
 {
 
-class Detector;
-
+// Lightweight view of one spectrum in a SpectrumStore
 class Spectrum
 {
 public:
 
-    typedef std::vector<int> ChannelList;
-    typedef ChannelList::size_type ChannelListSize;
+    typedef std::size_t ChannelListSize;
 
-    Spectrum() : mSessionIndex(0), mRealtime(0), mLivetime(0), mDoserate(0.0) {}
-    explicit Spectrum(const QSqlQuery &query);
-    Spectrum(const Spectrum &rhs) = delete;
-    ~Spectrum() = default;
+    Spectrum(const SpectrumStore &store, SpectrumStoreSize index)
+        : mStore(&store), mIndex(index) {}
 
-    Spectrum &operator = (const Spectrum &) = delete;
+    SpectrumStoreSize index() const { return mIndex; }
 
-    QString sessionName() const { return mSessionName; }
-    int sessionIndex() const { return mSessionIndex; }
+    QString sessionName() const { return mStore->sessionName(); }
+    int sessionIndex() const { return mStore->sessionIndices()[mIndex]; }
 
-    QDateTime gpsTimeStart() const { return mGpsTimeStart; }
-    int realtime() const { return mRealtime; }
-    int livetime() const { return mLivetime; }
+    QDateTime gpsTimeStart() const;
+    int realtime() const { return mStore->realtimes()[mIndex]; }
+    int livetime() const { return mStore->livetimes()[mIndex]; }
 
-    ChannelListSize numChannels() const { return mChannels.size(); }
-    const ChannelList &channels() const { return mChannels; }
+    ChannelListSize numChannels() const { return mStore->numChannels(mIndex); }
+    const int *channels() const { return mStore->channels(mIndex); }
     int channel(ChannelListSize index) const;
 
-    void calculateDoserate(const Detector &detector, lua_State *L);
-    double doserate() const { return mDoserate; }
+    double doserate() const { return mStore->doserates()[mIndex]; }
 
-    QGeoCoordinate coordinate;
-    QVector3D position;
+    QGeoCoordinate coordinate() const;
+    double latitude() const { return mStore->latitudes()[mIndex]; }
+    double longitude() const { return mStore->longitudes()[mIndex]; }
+    double altitude() const { return mStore->altitudes()[mIndex]; }
+    QVector3D position() const { return mStore->positions()[mIndex]; }
 
 private:
 
-    void loadQuery(const QSqlQuery &query);
-
-    QString mSessionName;
-    int mSessionIndex;
-    QDateTime mGpsTimeStart;
-    int mRealtime;
-    int mLivetime;
-    ChannelList mChannels;
-    double mDoserate = 0.0;
+    const SpectrumStore *mStore;
+    SpectrumStoreSize mIndex;
 };
 
 } // namespace Gamma
@@ -0,0 +1,450 @@
+//  gamma-viewer-3d - 3d visualization of sessions generated by gamma-analyzer
+//  Copyright (C) 2017  Dag Robole
+//
+//  This program is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "spectrummarkerentity.h"
+#include "exceptions.h"
+#include <algorithm>
+#include <cmath>
+#include <utility>
+#include <QByteArray>
+#include <QMatrix4x4>
+
+constexpr float SpectrumMarkerEntity::MarkerRadius;
+constexpr float SpectrumMarkerEntity::DefaultScreenRadius;
+constexpr float SpectrumMarkerEntity::LodDistance;
+const std::size_t SpectrumMarkerEntity::LodMinInstances;
+
+static_assert(sizeof(SpectrumMarkerEntity::Instance) == 20,
+              "Instance data must be tightly packed");
+
+// Scrambles spectrum indices, so instances ordered by it are spread evenly
+// over a chunk and any prefix is a representative subset
+static unsigned int lodPriority(unsigned int index)
+{
+    index ^= index >> 16;
+    index *= 0x7feb352dU;
+    index ^= index >> 15;
+    index *= 0x846ca68bU;
+    index ^= index >> 16;
+    return index;
+}
+
+SpectrumMarkerEntity::SpectrumMarkerEntity(Qt3DCore::QEntity *parent)
+    :
+      Qt3DCore::QEntity(parent),
+      mSphere(new Qt3DExtras::QSphereGeometry(this)),
+      mQuad(new Qt3DRender::QGeometry(this)),
+      mQuadBuffer(new Qt3DRender::QBuffer(Qt3DRender::QBuffer::VertexBuffer, mQuad)),
+      mQuadAttribute(new Qt3DRender::QAttribute(mQuad)),
+      mMaterial(new MarkerMaterial(this)),
+      mCamera(nullptr),
+      mViewportHeight(0.0f),
+      mUpdateTimer(new QTimer(this))
+{
+    // Chunks arriving while a session loads share one upload
+    mUpdateTimer->setSingleShot(true);
+    mUpdateTimer->setInterval(100);
+    QObject::connect(mUpdateTimer,
+                     &QTimer::timeout,
+                     this,
+                     &SpectrumMarkerEntity::updateBuffers);
+
+    // Same tessellation as the default QSphereMesh, scaled per instance.
+    // The vertex data is shared by the geometry of every chunk.
+    mSphere->setRadius(1.0f);
+    mSphere->setRings(16);
+    mSphere->setSlices(16);
+
+    // Corners of the sprite quad, drawn as a triangle strip
+    const float corners[] = { -1.0f, -1.0f, 0.0f,
+                               1.0f, -1.0f, 0.0f,
+                              -1.0f,  1.0f, 0.0f,
+                               1.0f,  1.0f, 0.0f };
+    mQuadBuffer->setData(QByteArray(reinterpret_cast<const char*>(corners), sizeof(corners)));
+
+    mQuadAttribute->setName(Qt3DRender::QAttribute::defaultPositionAttributeName());
+    mQuadAttribute->setAttributeType(Qt3DRender::QAttribute::VertexAttribute);
+    mQuadAttribute->setVertexBaseType(Qt3DRender::QAttribute::Float);
+    mQuadAttribute->setVertexSize(3);
+    mQuadAttribute->setByteStride(3 * sizeof(float));
+    mQuadAttribute->setCount(4);
+    mQuadAttribute->setBuffer(mQuadBuffer);
+    mQuad->addAttribute(mQuadAttribute);
+
+    // A few vertices per marker instead of a few hundred
+    mMaterial->setStyle(MarkerMaterial::Sprites);
+    mMaterial->setScreenRadius(DefaultScreenRadius);
+}
+
+SpectrumMarkerEntity::~SpectrumMarkerEntity()
+{
+    mMaterial->deleteLater();
+    for(auto &chunk : mChunks)
+        chunk.renderer->deleteLater();
+}
+
+void SpectrumMarkerEntity::setCamera(Qt3DRender::QCamera *camera)
+{
+    if(mCamera)
+        mCamera->disconnect(this);
+
+    mCamera = camera;
+
+    if(mCamera)
+    {
+        QObject::connect(mCamera,
+                         &Qt3DRender::QCamera::viewMatrixChanged,
+                         this,
+                         &SpectrumMarkerEntity::updateVisibility);
+
+        QObject::connect(mCamera,
+                         &Qt3DRender::QCamera::projectionMatrixChanged,
+                         this,
+                         &SpectrumMarkerEntity::updateVisibility);
+    }
+
+    updateVisibility();
+}
+
+void SpectrumMarkerEntity::setStyle(MarkerMaterial::Style style)
+{
+    if(style == mMaterial->style())
+        return;
+
+    mMaterial->setStyle(style);
+
+    auto attributes = meshAttributes();
+    for(auto &chunk : mChunks)
+        setMeshAttributes(chunk, attributes);
+
+    // The culling margin depends on the style
+    updateVisibility();
+}
+
+float SpectrumMarkerEntity::screenRadius() const
+{
+    return mMaterial->style() == MarkerMaterial::Sprites ? mMaterial->screenRadius() : 0.0f;
+}
+
+void SpectrumMarkerEntity::setScreenRadius(float pixels)
+{
+    mMaterial->setScreenRadius(pixels);
+    updateVisibility();
+}
+
+void SpectrumMarkerEntity::setViewportHeight(float pixels)
+{
+    if(pixels == mViewportHeight)
+        return;
+
+    mViewportHeight = pixels;
+    if(screenRadius() > 0.0f)
+        updateVisibility();
+}
+
+std::vector<Qt3DRender::QAttribute*> SpectrumMarkerEntity::meshAttributes() const
+{
+    if(mMaterial->style() == MarkerMaterial::Sprites)
+        return { mQuadAttribute };
+
+    return { mSphere->positionAttribute(),
+             mSphere->normalAttribute(),
+             mSphere->indexAttribute() };
+}
+
+void SpectrumMarkerEntity::setMeshAttributes(Chunk &chunk,
+                                             const std::vector<Qt3DRender::QAttribute*> &attributes)
+{
+    // Instance attributes stay, the mesh attributes of the other style go
+    for(auto attribute : chunk.geometry->attributes())
+    {
+        if(attribute->divisor() == 0)
+            chunk.geometry->removeAttribute(attribute);
+    }
+
+    for(auto attribute : attributes)
+        chunk.geometry->addAttribute(attribute);
+
+    chunk.renderer->setPrimitiveType(mMaterial->style() == MarkerMaterial::Sprites
+                                     ? Qt3DRender::QGeometryRenderer::TriangleStrip
+                                     : Qt3DRender::QGeometryRenderer::Triangles);
+}
+
+int SpectrumMarkerEntity::acquireChunk()
+{
+    if(!mFreeChunks.empty())
+    {
+        int index = mFreeChunks.back();
+        mFreeChunks.pop_back();
+        return index;
+    }
+
+    Chunk chunk;
+    chunk.entity = new Qt3DCore::QEntity(this);
+    chunk.geometry = new Qt3DRender::QGeometry(chunk.entity);
+    chunk.renderer = new Qt3DRender::QGeometryRenderer(chunk.entity);
+    chunk.buffer = new Qt3DRender::QBuffer(Qt3DRender::QBuffer::VertexBuffer, chunk.geometry);
+    chunk.count = 0;
+    chunk.drawnCount = 0;
+
+    chunk.positionAttribute = addInstanceAttribute(chunk, QStringLiteral("instancePosition"),
+                                                   Qt3DRender::QAttribute::Float, 3,
+                                                   offsetof(Instance, x));
+    chunk.scaleAttribute = addInstanceAttribute(chunk, QStringLiteral("instanceScale"),
+                                                Qt3DRender::QAttribute::Float, 1,
+                                                offsetof(Instance, scale));
+    chunk.colorAttribute = addInstanceAttribute(chunk, QStringLiteral("instanceColor"),
+                                                Qt3DRender::QAttribute::UnsignedByte, 4,
+                                                offsetof(Instance, color));
+
+    setMeshAttributes(chunk, meshAttributes());
+    chunk.renderer->setGeometry(chunk.geometry);
+    chunk.renderer->setInstanceCount(0);
+    chunk.renderer->setEnabled(false);
+
+    chunk.entity->addComponent(chunk.renderer);
+    chunk.entity->addComponent(mMaterial);
+
+    mChunks.push_back(chunk);
+    return (int)mChunks.size() - 1;
+}
+
+void SpectrumMarkerEntity::releaseChunk(int index)
+{
+    uploadChunk(index, std::vector<unsigned int>());
+    mChunks[index].drawnCount = 0;
+    mFreeChunks.push_back(index);
+}
+
+Qt3DRender::QAttribute *SpectrumMarkerEntity::addInstanceAttribute(
+        Chunk &chunk,
+        const QString &name,
+        Qt3DRender::QAttribute::VertexBaseType type,
+        uint size,
+        uint offset)
+{
+    auto attribute = new Qt3DRender::QAttribute(chunk.geometry);
+    attribute->setName(name);
+    attribute->setAttributeType(Qt3DRender::QAttribute::VertexAttribute);
+    attribute->setVertexBaseType(type);
+    attribute->setVertexSize(size);
+    attribute->setByteOffset(offset);
+    attribute->setByteStride(sizeof(Instance));
+    attribute->setDivisor(1);
+    attribute->setBuffer(chunk.buffer);
+    chunk.geometry->addAttribute(attribute);
+
+    return attribute;
+}
+
+void SpectrumMarkerEntity::appendMarkers(const std::vector<QVector3D> &positions,
+                                         const std::vector<Gamma::ColorRGBA8> &colors)
+{
+    if(positions.size() != colors.size())
+        throw Exception_IndexOutOfBounds("SpectrumMarkerEntity::appendMarkers");
+
+    mInstances.reserve(mInstances.size() + positions.size());
+    for(std::size_t i = 0; i < positions.size(); i++)
+    {
+        Instance instance;
+        instance.x = positions[i].x();
+        instance.y = positions[i].y();
+        instance.z = positions[i].z();
+        instance.scale = MarkerRadius;
+        instance.color = colors[i];
+        mInstances.push_back(instance);
+        mOctree.insert(positions[i]);
+    }
+
+    mItemChunks.resize(mInstances.size(), -1);
+    mItemRanks.resize(mInstances.size(), 0);
+
+    scheduleUpdate();
+}
+
+void SpectrumMarkerEntity::setColors(const std::vector<Gamma::ColorRGBA8> &colors)
+{
+    if(colors.size() != mInstances.size())
+        throw Exception_IndexOutOfBounds("SpectrumMarkerEntity::setColors");
+
+    for(std::size_t i = 0; i < colors.size(); i++)
+        mInstances[i].color = colors[i];
+
+    mOctree.markAllDirty();
+    scheduleUpdate();
+}
+
+void SpectrumMarkerEntity::clear()
+{
+    mUpdateTimer->stop();
+    mInstances.clear();
+    mItemChunks.clear();
+    mItemRanks.clear();
+    mOctree.clear();
+
+    for(int chunk : mNodeChunks)
+    {
+        if(chunk >= 0)
+            releaseChunk(chunk);
+    }
+    mNodeChunks.clear();
+
+    updateVisibility();
+}
+
+void SpectrumMarkerEntity::scheduleUpdate()
+{
+    if(!mUpdateTimer->isActive())
+        mUpdateTimer->start();
+}
+
+bool SpectrumMarkerEntity::isDrawn(std::size_t index) const
+{
+    if(index >= mItemChunks.size() || mItemChunks[index] < 0)
+        return false;
+
+    return mItemRanks[index] < mChunks[mItemChunks[index]].drawnCount;
+}
+
+void SpectrumMarkerEntity::uploadChunk(int index, const std::vector<unsigned int> &items)
+{
+    Chunk &chunk = mChunks[index];
+
+    // Instances in priority order, so distant chunks can draw a prefix
+    std::vector<std::pair<unsigned int, unsigned int>> order;
+    order.reserve(items.size());
+    for(unsigned int item : items)
+        order.emplace_back(lodPriority(item), item);
+    std::sort(order.begin(), order.end());
+
+    // Each chunk buffer is uploaded in one go, instances are never drawn
+    // from a partially updated buffer
+    QByteArray data;
+    data.resize((int)(items.size() * sizeof(Instance)));
+    auto instances = reinterpret_cast<Instance*>(data.data());
+    for(std::size_t i = 0; i < order.size(); i++)
+    {
+        unsigned int item = order[i].second;
+        instances[i] = mInstances[item];
+        mItemChunks[item] = index;
+        mItemRanks[item] = (unsigned int)i;
+    }
+
+    chunk.buffer->setData(data);
+
+    uint count = (uint)items.size();
+    chunk.positionAttribute->setCount(count);
+    chunk.scaleAttribute->setCount(count);
+    chunk.colorAttribute->setCount(count);
+    chunk.count = items.size();
+}
+
+void SpectrumMarkerEntity::updateBuffers()
+{
+    const auto &nodes = mOctree.nodes();
+    mNodeChunks.resize(nodes.size(), -1);
+
+    for(std::size_t i = 0; i < nodes.size(); i++)
+    {
+        const MarkerOctree::Node &node = nodes[i];
+        int &chunk = mNodeChunks[i];
+
+        // Leaves that were split hand their chunk on
+        if(!node.leaf)
+        {
+            if(chunk >= 0)
+            {
+                releaseChunk(chunk);
+                chunk = -1;
+            }
+            continue;
+        }
+
+        if(!node.dirty)
+            continue;
+
+        if(chunk < 0)
+            chunk = acquireChunk();
+
+        uploadChunk(chunk, node.items);
+    }
+
+    mOctree.clearDirty();
+    updateVisibility();
+}
+
+void SpectrumMarkerEntity::updateVisibility()
+{
+    const auto &nodes = mOctree.nodes();
+    std::vector<std::size_t> counts(mChunks.size(), 0);
+
+    if(!mCamera)
+    {
+        for(std::size_t i = 0; i < mChunks.size(); i++)
+            counts[i] = mChunks[i].count;
+    }
+    else
+    {
+        QMatrix4x4 projection = mCamera->projectionMatrix();
+        QMatrix4x4 viewProjection = projection * mCamera->viewMatrix();
+        QVector3D eye = mCamera->position();
+
+        // Sprites cover more world units the farther they are, same factor
+        // as picking uses
+        float marginPerDistance = 0.0f;
+        float pixels = screenRadius();
+        if(pixels > 0.0f && mViewportHeight > 0.0f)
+            marginPerDistance = 2.0f * pixels / (mViewportHeight * projection(1, 1));
+
+        mOctree.visibleLeaves(viewProjection, MarkerRadius, eye, marginPerDistance, mVisibleLeaves);
+
+        const float lodDistance2 = LodDistance * LodDistance;
+
+        for(int leaf : mVisibleLeaves)
+        {
+            // Leaves added since the last upload have no chunk yet
+            if((std::size_t)leaf >= mNodeChunks.size() || mNodeChunks[leaf] < 0)
+                continue;
+
+            const MarkerOctree::Node &node = nodes[leaf];
+            int chunk = mNodeChunks[leaf];
+            std::size_t count = mChunks[chunk].count;
+
+            // Squared distance from the camera to the bounds of the chunk
+            float distance2 = 0.0f;
+            for(int axis = 0; axis < 3; axis++)
+            {
+                float d = std::max({ node.min[axis] - eye[axis], eye[axis] - node.max[axis], 0.0f });
+                distance2 += d * d;
+            }
+
+            if(distance2 > lodDistance2)
+            {
+                std::size_t lodCount = (std::size_t)std::ceil(count * (lodDistance2 / distance2));
+                count = std::max(lodCount, std::min(count, LodMinInstances));
+            }
+
+            counts[chunk] = count;
+        }
+    }
+
+    for(std::size_t i = 0; i < mChunks.size(); i++)
+    {
+        mChunks[i].drawnCount = counts[i];
+        mChunks[i].renderer->setInstanceCount((int)counts[i]);
+        mChunks[i].renderer->setEnabled(counts[i] > 0);
+    }
+}
@@ -0,0 +1,148 @@
+//  gamma-viewer-3d - 3d visualization of sessions generated by gamma-analyzer
+//  Copyright (C) 2017  Dag Robole
+//
+//  This program is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef SPECTRUMMARKERENTITY_H
+#define SPECTRUMMARKERENTITY_H
+
+#include "markermaterial.h"
+#include "markeroctree.h"
+#include "colormap.h"
+#include <cstddef>
+#include <vector>
+#include <QVector3D>
+#include <QTimer>
+#include <Qt3DCore/QEntity>
+#include <Qt3DRender/QCamera>
+#include <Qt3DRender/QGeometry>
+#include <Qt3DRender/QGeometryRenderer>
+#include <Qt3DRender/QBuffer>
+#include <Qt3DRender/QAttribute>
+#include <Qt3DExtras/QSphereGeometry>
+
+// Draws the markers of all spectra in a session as instances of one sphere,
+// or of one camera facing sprite, see MarkerMaterial::Style. Markers are
+// bucketed into the leaves of an octree, and every leaf is drawn as one
+// chunk with its own instance buffer. Chunks outside the view of the camera
+// are not drawn, and distant chunks draw only a subset of their markers.
+class SpectrumMarkerEntity : public Qt3DCore::QEntity
+{
+    Q_OBJECT
+
+public:
+
+    explicit SpectrumMarkerEntity(Qt3DCore::QEntity *parent);
+    ~SpectrumMarkerEntity() override;
+
+    // Interleaved per-instance data, 20 bytes per spectrum
+    struct Instance
+    {
+        float x, y, z;
+        float scale;
+        Gamma::ColorRGBA8 color;
+    };
+
+    std::size_t count() const { return mInstances.size(); }
+
+    // Culling and level of detail follow this camera, without a camera all
+    // markers are drawn
+    void setCamera(Qt3DRender::QCamera *camera);
+
+    MarkerMaterial::Style style() const { return mMaterial->style(); }
+    void setStyle(MarkerMaterial::Style style);
+
+    // Radius of sprites in pixels, zero for MarkerRadius in world units.
+    // Spheres always use MarkerRadius, screenRadius is zero for them.
+    float screenRadius() const;
+    void setScreenRadius(float pixels);
+
+    // Height of the viewport in device pixels, culling grows the bounds of
+    // distant chunks by the world size of a sprite at that height
+    void setViewportHeight(float pixels);
+
+    // Marker i is the spectrum with index i
+    void appendMarkers(const std::vector<QVector3D> &positions,
+                       const std::vector<Gamma::ColorRGBA8> &colors);
+    void setColors(const std::vector<Gamma::ColorRGBA8> &colors);
+    void clear();
+
+    // Whether marker i is drawn now. Markers of culled chunks, beyond the
+    // level of detail of their chunk or not uploaded yet are not.
+    bool isDrawn(std::size_t index) const;
+
+    static constexpr float MarkerRadius = 0.5f;
+    static constexpr float DefaultScreenRadius = 4.0f;
+
+    // Chunks farther away than this draw a share of their markers falling
+    // with the square of the distance, but never fewer than LodMinInstances
+    static constexpr float LodDistance = 400.0f;
+    static const std::size_t LodMinInstances = 256;
+
+private:
+
+    struct Chunk
+    {
+        Qt3DCore::QEntity *entity;
+        Qt3DRender::QGeometry *geometry;
+        Qt3DRender::QGeometryRenderer *renderer;
+        Qt3DRender::QBuffer *buffer;
+        Qt3DRender::QAttribute *positionAttribute;
+        Qt3DRender::QAttribute *scaleAttribute;
+        Qt3DRender::QAttribute *colorAttribute;
+        std::size_t count;
+        // Instances drawn after culling and level of detail, a prefix
+        std::size_t drawnCount;
+    };
+
+    Qt3DExtras::QSphereGeometry *mSphere;
+    Qt3DRender::QGeometry *mQuad;
+    Qt3DRender::QBuffer *mQuadBuffer;
+    Qt3DRender::QAttribute *mQuadAttribute;
+    MarkerMaterial *mMaterial;
+    Qt3DRender::QCamera *mCamera;
+    float mViewportHeight;
+    QTimer *mUpdateTimer;
+
+    std::vector<Instance> mInstances;
+    MarkerOctree mOctree;
+
+    // Chunks by octree node, -1 where a node has none. Chunks of split
+    // leaves are kept in a free list for reuse.
+    std::vector<Chunk> mChunks;
+    std::vector<int> mNodeChunks;
+    std::vector<int> mFreeChunks;
+    std::vector<int> mVisibleLeaves;
+
+    // Chunk of every marker and its place in the chunk buffer, -1 before
+    // the first upload
+    std::vector<int> mItemChunks;
+    std::vector<unsigned int> mItemRanks;
+
+    int acquireChunk();
+    void releaseChunk(int index);
+    std::vector<Qt3DRender::QAttribute*> meshAttributes() const;
+    void setMeshAttributes(Chunk &chunk, const std::vector<Qt3DRender::QAttribute*> &attributes);
+    Qt3DRender::QAttribute *addInstanceAttribute(Chunk &chunk,
+                                                 const QString &name,
+                                                 Qt3DRender::QAttribute::VertexBaseType type,
+                                                 uint size,
+                                                 uint offset);
+    void uploadChunk(int index, const std::vector<unsigned int> &items);
+    void scheduleUpdate();
+    void updateBuffers();
+    void updateVisibility();
+};
+
+#endif // SPECTRUMMARKERENTITY_H
@@ -0,0 +1,322 @@
+//  gamma-viewer-3d - 3d visualization of sessions generated by gamma-analyzer
+//  Copyright (C) 2017  Dag Robole
+//
+//  This program is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#include "spectrumstore.h"
+#include "geo.h"
+#include "channelparser.h"
+#include <cstring>
+#include <QGeoCoordinate>
+
+namespace Gamma
+{
+
+static_assert(sizeof(QVector3D) == 3 * sizeof(float),
+              "QVector3D must be three packed floats to be stored raw");
+
+static bool writePadded(QIODevice &device, const void *data, std::size_t size)
+{
+    static const char zeros[8] = {};
+
+    if(size && device.write(static_cast<const char*>(data), (qint64)size) != (qint64)size)
+        return false;
+
+    qint64 padding = (qint64)((8 - size % 8) % 8);
+    return padding == 0 || device.write(zeros, padding) == padding;
+}
+
+template<typename T>
+static bool writeColumn(QIODevice &device, const std::vector<T> &column)
+{
+    return writePadded(device, column.data(), column.size() * sizeof(T));
+}
+
+static bool readPadded(const uchar *&data, const uchar *end, void *out, std::size_t size)
+{
+    std::size_t padded = (size + 7) & ~(std::size_t)7;
+    if((std::size_t)(end - data) < padded)
+        return false;
+
+    if(size)
+        std::memcpy(out, data, size);
+    data += padded;
+
+    return true;
+}
+
+template<typename T>
+static bool readColumn(const uchar *&data, const uchar *end,
+                       std::size_t count, std::vector<T> &column)
+{
+    if(count > (std::size_t)(end - data) / sizeof(T))
+        return false;
+
+    std::size_t base = column.size();
+    column.resize(base + count);
+
+    return readPadded(data, end, column.data() + base, count * sizeof(T));
+}
+
+static bool skipColumn(const uchar *&data, const uchar *end,
+                       std::size_t count, std::size_t elementSize)
+{
+    if(count > (std::size_t)(end - data) / elementSize)
+        return false;
+
+    std::size_t padded = (count * elementSize + 7) & ~(std::size_t)7;
+    if((std::size_t)(end - data) < padded)
+        return false;
+
+    data += padded;
+    return true;
+}
+
+void SpectrumStore::clear()
+{
+    mSessionName = "";
+    mChannels.clear();
+    mChannelOffsets.assign(1, 0);
+    mSessionIndices.clear();
+    mStartTimes.clear();
+    mRealtimes.clear();
+    mLivetimes.clear();
+    mLatitudes.clear();
+    mLongitudes.clear();
+    mAltitudes.clear();
+    mPositions.clear();
+    mDoserates.clear();
+    mModelDoserates.clear();
+}
+
+void SpectrumStore::reserve(SpectrumStoreSize numSpectra, std::size_t numChannels)
+{
+    mChannels.reserve(numChannels);
+    mChannelOffsets.reserve(numSpectra + 1);
+    mSessionIndices.reserve(numSpectra);
+    mStartTimes.reserve(numSpectra);
+    mRealtimes.reserve(numSpectra);
+    mLivetimes.reserve(numSpectra);
+    mLatitudes.reserve(numSpectra);
+    mLongitudes.reserve(numSpectra);
+    mAltitudes.reserve(numSpectra);
+    mPositions.reserve(numSpectra);
+    mDoserates.reserve(numSpectra);
+    mModelDoserates.reserve(numSpectra * mModelCount);
+}
+
+void SpectrumStore::setModelCount(std::size_t modelCount)
+{
+    mModelCount = modelCount ? modelCount : 1;
+    mModelDoserates.assign(size() * mModelCount, 0.0);
+}
+
+void SpectrumStore::selectModel(std::size_t model)
+{
+    if(model >= mModelCount)
+        throw Exception_IndexOutOfBounds("SpectrumStore::selectModel");
+
+    for(SpectrumStoreSize i = 0; i < size(); i++)
+        mDoserates[i] = mModelDoserates[i * mModelCount + model];
+}
+
+void SpectrumStore::appendSpectrum(int sessionIndex,
+                                   qint64 startTime,
+                                   int realtime,
+                                   int livetime,
+                                   double latitude,
+                                   double longitude,
+                                   double altitude,
+                                   const char *channels,
+                                   std::size_t channelsSize)
+{
+    appendColumns(sessionIndex, startTime, realtime, livetime,
+                  latitude, longitude, altitude);
+
+    parseChannels(channels, channelsSize, mChannels);
+    mChannelOffsets.push_back(mChannels.size());
+}
+
+void SpectrumStore::appendSpectrum(int sessionIndex,
+                                   qint64 startTime,
+                                   int realtime,
+                                   int livetime,
+                                   double latitude,
+                                   double longitude,
+                                   double altitude,
+                                   const unsigned short *channels,
+                                   std::size_t channelsSize)
+{
+    appendColumns(sessionIndex, startTime, realtime, livetime,
+                  latitude, longitude, altitude);
+
+    parseChannels(channels, channelsSize, mChannels);
+    mChannelOffsets.push_back(mChannels.size());
+}
+
+void SpectrumStore::appendColumns(int sessionIndex,
+                                  qint64 startTime,
+                                  int realtime,
+                                  int livetime,
+                                  double latitude,
+                                  double longitude,
+                                  double altitude)
+{
+    mSessionIndices.push_back(sessionIndex);
+    mStartTimes.push_back(startTime);
+    mRealtimes.push_back(realtime);
+    mLivetimes.push_back(livetime);
+
+    QGeoCoordinate coordinate;
+    coordinate.setLatitude(latitude);
+    coordinate.setLongitude(longitude);
+    coordinate.setAltitude(altitude);
+    mLatitudes.push_back(coordinate.latitude());
+    mLongitudes.push_back(coordinate.longitude());
+    mAltitudes.push_back(coordinate.altitude());
+    mPositions.push_back(Geo::geodeticToCartesian(coordinate));
+
+    mDoserates.push_back(0.0);
+    mModelDoserates.insert(mModelDoserates.end(), mModelCount, 0.0);
+}
+
+void SpectrumStore::dropChannels()
+{
+    std::vector<int>().swap(mChannels);
+    mChannelOffsets.assign(size() + 1, 0);
+}
+
+void SpectrumStore::append(const SpectrumStore &other)
+{
+    if(empty())
+    {
+        mSessionName = other.mSessionName;
+        mModelCount = other.mModelCount;
+    }
+    else if(other.mModelCount != mModelCount && !other.empty())
+        throw Exception_NumericRangeError("SpectrumStore::append: model count");
+
+    // Offsets of the appended spectra are shifted past our own channels
+    std::size_t channelBase = mChannels.size();
+    mChannels.insert(mChannels.end(), other.mChannels.begin(), other.mChannels.end());
+    for(auto it = other.mChannelOffsets.begin() + 1; it != other.mChannelOffsets.end(); ++it)
+        mChannelOffsets.push_back(channelBase + *it);
+
+    mSessionIndices.insert(mSessionIndices.end(), other.mSessionIndices.begin(), other.mSessionIndices.end());
+    mStartTimes.insert(mStartTimes.end(), other.mStartTimes.begin(), other.mStartTimes.end());
+    mRealtimes.insert(mRealtimes.end(), other.mRealtimes.begin(), other.mRealtimes.end());
+    mLivetimes.insert(mLivetimes.end(), other.mLivetimes.begin(), other.mLivetimes.end());
+    mLatitudes.insert(mLatitudes.end(), other.mLatitudes.begin(), other.mLatitudes.end());
+    mLongitudes.insert(mLongitudes.end(), other.mLongitudes.begin(), other.mLongitudes.end());
+    mAltitudes.insert(mAltitudes.end(), other.mAltitudes.begin(), other.mAltitudes.end());
+    mPositions.insert(mPositions.end(), other.mPositions.begin(), other.mPositions.end());
+    mDoserates.insert(mDoserates.end(), other.mDoserates.begin(), other.mDoserates.end());
+    mModelDoserates.insert(mModelDoserates.end(), other.mModelDoserates.begin(), other.mModelDoserates.end());
+}
+
+bool SpectrumStore::writeBlock(QIODevice &device) const
+{
+    quint64 header[3] = { (quint64)size(), (quint64)mChannels.size(), (quint64)mModelCount };
+    if(!writePadded(device, header, sizeof(header)))
+        return false;
+
+    QByteArray name = mSessionName.toUtf8();
+    quint64 nameSize = (quint64)name.size();
+    if(!writePadded(device, &nameSize, sizeof(nameSize)) ||
+            !writePadded(device, name.constData(), (std::size_t)name.size()))
+        return false;
+
+    std::vector<quint64> offsets(mChannelOffsets.begin(), mChannelOffsets.end());
+
+    return writeColumn(device, mChannels) &&
+            writeColumn(device, offsets) &&
+            writeColumn(device, mSessionIndices) &&
+            writeColumn(device, mStartTimes) &&
+            writeColumn(device, mRealtimes) &&
+            writeColumn(device, mLivetimes) &&
+            writeColumn(device, mLatitudes) &&
+            writeColumn(device, mLongitudes) &&
+            writeColumn(device, mAltitudes) &&
+            writeColumn(device, mPositions) &&
+            writeColumn(device, mDoserates) &&
+            writeColumn(device, mModelDoserates);
+}
+
+bool SpectrumStore::appendBlock(const uchar *&data, const uchar *end, bool withChannels)
+{
+    quint64 header[3];
+    if(!readPadded(data, end, header, sizeof(header)))
+        return false;
+
+    std::size_t modelCount = (std::size_t)header[2];
+    if(modelCount == 0 || (!empty() && modelCount != mModelCount))
+        return false;
+
+    quint64 nameSize;
+    if(!readPadded(data, end, &nameSize, sizeof(nameSize)) ||
+            nameSize > (quint64)(end - data))
+        return false;
+
+    std::size_t paddedNameSize = ((std::size_t)nameSize + 7) & ~(std::size_t)7;
+    if(paddedNameSize > (std::size_t)(end - data))
+        return false;
+
+    QString name = QString::fromUtf8(reinterpret_cast<const char*>(data), (int)nameSize);
+    data += paddedNameSize;
+
+    std::size_t count = (std::size_t)header[0];
+    std::size_t numChannels = (std::size_t)header[1];
+    std::size_t channelBase = mChannels.size();
+
+    bool channelsRead = withChannels ?
+                readColumn(data, end, numChannels, mChannels) :
+                skipColumn(data, end, numChannels, sizeof(int));
+
+    std::vector<quint64> offsets;
+    if(!channelsRead || !readColumn(data, end, count + 1, offsets))
+        return false;
+
+    // Offsets must describe exactly the channels of the block
+    if(offsets.front() != 0 || offsets.back() != numChannels)
+        return false;
+    for(std::size_t i = 1; i < offsets.size(); i++)
+    {
+        if(offsets[i] < offsets[i - 1])
+            return false;
+        mChannelOffsets.push_back(withChannels ?
+                                      channelBase + (std::size_t)offsets[i] : channelBase);
+    }
+
+    if(empty())
+    {
+        mSessionName = name;
+        mModelCount = modelCount;
+    }
+
+    if(count > std::numeric_limits<std::size_t>::max() / modelCount)
+        return false;
+
+    return readColumn(data, end, count, mSessionIndices) &&
+            readColumn(data, end, count, mStartTimes) &&
+            readColumn(data, end, count, mRealtimes) &&
+            readColumn(data, end, count, mLivetimes) &&
+            readColumn(data, end, count, mLatitudes) &&
+            readColumn(data, end, count, mLongitudes) &&
+            readColumn(data, end, count, mAltitudes) &&
+            readColumn(data, end, count, mPositions) &&
+            readColumn(data, end, count, mDoserates) &&
+            readColumn(data, end, count * modelCount, mModelDoserates);
+}
+
+} // namespace Gamma
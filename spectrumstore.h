@@ -0,0 +1,156 @@
+//  gamma-viewer-3d - 3d visualization of sessions generated by gamma-analyzer
+//  Copyright (C) 2017  Dag Robole
+//
+//  This program is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  This program is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef SPECTRUMSTORE_H
+#define SPECTRUMSTORE_H
+
+#include "exceptions.h"
+#include <cstddef>
+#include <limits>
+#include <vector>
+#include <QtGlobal>
+#include <QString>
+#include <QVector3D>
+#include <QIODevice>
+
+namespace Gamma
+{
+
+typedef std::size_t SpectrumStoreSize;
+
+// Column store for the spectra of a session. All channels are kept in one
+// contiguous buffer, spectrum i owns channels [offsets[i], offsets[i + 1]).
+// A moved-from store must be cleared before it is used again.
+class SpectrumStore
+{
+public:
+
+    SpectrumStore() : mChannelOffsets(1, 0), mModelCount(1) {}
+    SpectrumStore(const SpectrumStore &rhs) = delete;
+    SpectrumStore(SpectrumStore &&rhs) = default;
+    ~SpectrumStore() = default;
+
+    SpectrumStore &operator = (const SpectrumStore &) = delete;
+    SpectrumStore &operator = (SpectrumStore &&) = default;
+
+    SpectrumStoreSize size() const { return mSessionIndices.size(); }
+    bool empty() const { return mSessionIndices.empty(); }
+
+    void clear();
+    void reserve(SpectrumStoreSize numSpectra, std::size_t numChannels);
+
+    // Appends one spectrum, the channel text is parsed straight into the store
+    void appendSpectrum(int sessionIndex,
+                        qint64 startTime,
+                        int realtime,
+                        int livetime,
+                        double latitude,
+                        double longitude,
+                        double altitude,
+                        const char *channels,
+                        std::size_t channelsSize);
+
+    void appendSpectrum(int sessionIndex,
+                        qint64 startTime,
+                        int realtime,
+                        int livetime,
+                        double latitude,
+                        double longitude,
+                        double altitude,
+                        const unsigned short *channels,
+                        std::size_t channelsSize);
+
+    void append(const SpectrumStore &other);
+
+    // Frees the channel buffer, every spectrum is left with zero channels
+    void dropChannels();
+
+    // Raw block of all columns, as stored in session cache files. Columns are
+    // padded to 8 bytes so a mapped block can be read without any parsing.
+    bool writeBlock(QIODevice &device) const;
+    bool appendBlock(const uchar *&data, const uchar *end, bool withChannels = true);
+
+    QString sessionName() const { return mSessionName; }
+    void setSessionName(QString sessionName) { mSessionName = sessionName; }
+
+    const int *channels(SpectrumStoreSize index) const
+    {
+        return mChannels.data() + mChannelOffsets[index];
+    }
+
+    std::size_t numChannels(SpectrumStoreSize index) const
+    {
+        return mChannelOffsets[index + 1] - mChannelOffsets[index];
+    }
+
+    const std::vector<int> &channelData() const { return mChannels; }
+    const std::vector<std::size_t> &channelOffsets() const { return mChannelOffsets; }
+
+    const std::vector<int> &sessionIndices() const { return mSessionIndices; }
+    const std::vector<qint64> &startTimes() const { return mStartTimes; }
+    const std::vector<int> &realtimes() const { return mRealtimes; }
+    const std::vector<int> &livetimes() const { return mLivetimes; }
+    const std::vector<double> &latitudes() const { return mLatitudes; }
+    const std::vector<double> &longitudes() const { return mLongitudes; }
+    const std::vector<double> &altitudes() const { return mAltitudes; }
+    const std::vector<QVector3D> &positions() const { return mPositions; }
+
+    // Doserates of the active dose model
+    const std::vector<double> &doserates() const { return mDoserates; }
+    std::vector<double> &doserates() { return mDoserates; }
+
+    // Doserates of all dose models, a size() x modelCount() matrix. Changing
+    // the model count resets the matrix to zero.
+    std::size_t modelCount() const { return mModelCount; }
+    void setModelCount(std::size_t modelCount);
+    const std::vector<double> &modelDoserates() const { return mModelDoserates; }
+    std::vector<double> &modelDoserates() { return mModelDoserates; }
+
+    // Copies the doserates of a model into the active column
+    void selectModel(std::size_t model);
+
+    // Start times are milliseconds since epoch, invalid times use this value
+    static const qint64 InvalidTime = std::numeric_limits<qint64>::min();
+
+private:
+
+    void appendColumns(int sessionIndex,
+                       qint64 startTime,
+                       int realtime,
+                       int livetime,
+                       double latitude,
+                       double longitude,
+                       double altitude);
+
+    QString mSessionName;
+    std::vector<int> mChannels;
+    std::vector<std::size_t> mChannelOffsets;
+    std::vector<int> mSessionIndices;
+    std::vector<qint64> mStartTimes;
+    std::vector<int> mRealtimes;
+    std::vector<int> mLivetimes;
+    std::vector<double> mLatitudes;
+    std::vector<double> mLongitudes;
+    std::vector<double> mAltitudes;
+    std::vector<QVector3D> mPositions;
+    std::vector<double> mDoserates;
+    std::size_t mModelCount;
+    std::vector<double> mModelDoserates;
+};
+
+} // namespace Gamma
+
+#endif // SPECTRUMSTORE_H